@@ -0,0 +1,141 @@
+#ifndef ASYNC_INFLUENCE_UPDATER_HPP
+#define ASYNC_INFLUENCE_UPDATER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <influence_map.hpp>
+#include <thread_pool.hpp>
+
+// immutable copy of every map of an AsyncInfluenceUpdater after one step
+struct InfluenceSnapshot {
+    // number of steps the maps had taken when the snapshot was made
+    std::uint64_t epoch;
+    // one grid per map, in the order the maps were given
+    std::vector<std::vector<float>> layers;
+};
+
+// steps a set of maps on a background thread and publishes a snapshot after every step
+//
+// the maps belong to the worker thread once the updater exists, changes to them (sources, collision,
+// settings) go through post() and run on the worker right before the next step
+// readers never block: a read announces the current reclamation epoch in the reader's slot and loads the
+// published pointer, a fixed number of steps. a replaced snapshot is only reused once every slot is either
+// idle or announced a later epoch, so a snapshot can not change under a reader that still holds it
+// a slot may hold several reads at once, nested, overlapping or from several threads sharing it, it keeps the
+// epoch of the first one announced until the last guard is gone, so every guard stays valid on its own
+// publishing never waits on readers either, while old snapshots are held the worker allocates new ones
+class AsyncInfluenceUpdater {
+    private:
+        struct ReaderSlot;
+
+    public:
+        static constexpr int MAX_READERS = 64;
+
+        // keeps a snapshot alive while it exists, any number of them per reader slot
+        class ReadGuard {
+            public:
+                ReadGuard(ReadGuard&& other) noexcept;
+                ReadGuard& operator=(ReadGuard&&) = delete;
+                ~ReadGuard();
+
+                const InfluenceSnapshot* operator->() const { return snapshot; }
+                const InfluenceSnapshot& operator*() const { return *snapshot; }
+                const InfluenceSnapshot* get() const { return snapshot; }
+
+            private:
+                ReadGuard(ReaderSlot* slot, const InfluenceSnapshot* snapshot) : slot(slot), snapshot(snapshot) {}
+
+            private:
+                ReaderSlot* slot;
+                const InfluenceSnapshot* snapshot;
+
+                friend class AsyncInfluenceUpdater;
+        };
+
+    public:
+        // the steps run on the pool through recalculate_parallel when one is given
+        AsyncInfluenceUpdater(std::vector<std::shared_ptr<InfluenceMap>> maps, ThreadPool* pool = nullptr);
+        ~AsyncInfluenceUpdater();
+
+        AsyncInfluenceUpdater(const AsyncInfluenceUpdater&) = delete;
+        AsyncInfluenceUpdater& operator=(const AsyncInfluenceUpdater&) = delete;
+
+        // queues count more steps and returns at once
+        void request_steps(int count = 1);
+        // runs command on the worker thread before the next step
+        void post(std::function<void()> command);
+        // blocks until every requested step and posted command has finished
+        void wait_idle();
+
+        // claims a reader slot, -1 when all MAX_READERS are taken
+        // a slot is meant for one thread, threads may share one safely but while their reads keep overlapping it
+        // holds the epoch of the first and every snapshot replaced meanwhile stays allocated
+        int register_reader();
+        void unregister_reader(int reader);
+
+        // latest snapshot, never null (the first one holds the maps as they were at construction)
+        ReadGuard read(int reader);
+
+        const std::uint64_t get_published_epoch() const { return published_epoch.load(std::memory_order_acquire); }
+        // snapshots allocated so far, stays small unless readers hold on to old ones
+        const int get_snapshot_count() const { return snapshot_count.load(std::memory_order_relaxed); }
+
+    private:
+        struct ReaderSlot {
+            // the guard count sits above the epoch in one word
+            static constexpr int READS_SHIFT = 48;
+            static constexpr std::uint64_t ONE_READ = std::uint64_t(1) << READS_SHIFT;
+            static constexpr std::uint64_t EPOCH_MASK = ONE_READ - 1;
+
+            std::atomic<bool> claimed{false};
+            // guards alive on the slot and the reclamation epoch announced by the first of them, 0 while idle
+            // one atomic so a read joining the slot and the last guard leaving it can not interleave, with two
+            // the leaving guard could clear the epoch a joining read on another thread just relied on
+            std::atomic<std::uint64_t> active_reads{0};
+        };
+
+        struct Retired {
+            InfluenceSnapshot* snapshot;
+            std::uint64_t epoch;
+        };
+
+    private:
+        void worker_loop();
+        void step();
+        void publish();
+        void reclaim();
+        InfluenceSnapshot* acquire_snapshot();
+
+    private:
+        std::vector<std::shared_ptr<InfluenceMap>> maps;
+        ThreadPool* pool;
+
+        // every snapshot ever made, the others below only point into it
+        std::vector<std::unique_ptr<InfluenceSnapshot>> snapshots;
+        std::vector<InfluenceSnapshot*> free_snapshots;
+        std::vector<Retired> retired;
+        std::atomic<InfluenceSnapshot*> current;
+        // one more per replaced snapshot, the 48 bits a reader slot keeps of it last for thousands of years of steps
+        std::atomic<std::uint64_t> reclaim_epoch;
+        std::atomic<std::uint64_t> published_epoch;
+        std::atomic<int> snapshot_count;
+        ReaderSlot readers[MAX_READERS];
+
+        std::mutex mutex;
+        std::condition_variable work_available, idle;
+        std::vector<std::function<void()>> commands;
+        int requested_steps;
+        bool busy;
+        bool stopping;
+        std::uint64_t steps_taken;
+        std::thread worker;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef CHUNK_POOL_HPP
+#define CHUNK_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// arena of fixed size float chunks, handed out from large slabs and recycled through a free list
+// not thread safe, maps sharing a pool must be updated from one thread at a time
+class ChunkPool {
+    public:
+        explicit ChunkPool(int chunk_floats, int chunks_per_slab = 256);
+
+        // returns a zero filled chunk
+        float* allocate();
+        void release(float* chunk);
+
+        const int get_chunk_floats() const { return chunk_floats; }
+        const std::size_t get_chunks_in_use() const { return in_use; }
+        const std::size_t get_reserved_bytes() const { return slabs.size() * chunks_per_slab * chunk_floats * sizeof(float); }
+
+        // read only chunk of zeros standing in for every chunk that was never allocated
+        const float* get_zero_chunk() const { return zero_chunk.get(); }
+
+    private:
+        int chunk_floats, chunks_per_slab;
+        std::size_t in_use;
+        std::vector<std::unique_ptr<float[]>> slabs;
+        std::vector<float*> free_chunks;
+        std::unique_ptr<float[]> zero_chunk;
+};
+
+#endif
@@ -1,24 +1,73 @@
 #ifndef COLLISION_MAP_HPP
 #define COLLISION_MAP_HPP
 
+#include <cstdint>
 #include <vector>
 
+// blocked tiles are stored one bit per tile, each row padded to a whole number of 64-bit words
+// so a row can be fetched with a few loads; padding bits are always zero
+//
+// tiles can also carry an 8-bit terrain class (forest, water, road, ...), one byte per tile in row order
+// what a class costs is up to each InfluenceMap, the map itself only stores the classes
+// the layer is only allocated by the first terrain edit, until then every tile is class 0
 class CollisionMap {
+    public:
+        // changes are tracked per square block of tiles so listeners can tell what changed
+        static constexpr int BLOCK_SIZE = 32;
+
     public:
         CollisionMap(int width, int height, int tile_size);
 
-        void draw(int start_x, int start_y, int end_x, int end_y);
         void set_blocked(int tile_x, int tile_y, bool blocked);
         const bool is_blocked(int tile_x, int tile_y);
 
-        const std::vector<bool>& get_collision_map() const { return collision_tiles; }
+        // bulk operations, the rectangle is clipped to the map
+        void set_blocked_rect(int tile_x, int tile_y, int rect_width, int rect_height, bool blocked);
+        void clear();
+        // replaces every row, words holds get_words_per_row() words per row like get_collision_words()
+        void assign_words(const std::uint64_t* words);
+        int count_blocked(int tile_x, int tile_y, int rect_width, int rect_height) const;
+
+        void set_terrain(int tile_x, int tile_y, std::uint8_t terrain_class);
+        void set_terrain_rect(int tile_x, int tile_y, int rect_width, int rect_height, std::uint8_t terrain_class);
+        const std::uint8_t get_terrain(int tile_x, int tile_y) const;
+        // drops the layer, every tile goes back to class 0
+        void clear_terrain();
+        // replaces every class, classes holds width * height bytes in row order like get_terrain_classes()
+        void assign_terrain(const std::uint8_t* classes);
+        const bool has_terrain() const { return !terrain.empty(); }
+        // null while there is no terrain layer
+        const std::uint8_t* get_terrain_row(int tile_y) const { return terrain.empty() ? nullptr : &terrain[static_cast<std::size_t>(width) * tile_y]; }
+        // empty while there is no terrain layer
+        const std::vector<std::uint8_t>& get_terrain_classes() const { return terrain; }
+
+        const std::uint64_t* get_row_words(int tile_y) const { return &collision_words[words_per_row * tile_y]; }
+        const std::vector<std::uint64_t>& get_collision_words() const { return collision_words; }
+        const int get_words_per_row() const { return words_per_row; }
+
+        // revision is bumped on every change, block revisions record the revision of their last change
+        const std::uint64_t get_revision() const { return revision; }
+        const std::uint64_t get_block_revision(int block_x, int block_y) const { return block_revisions[blocks_x * block_y + block_x]; }
+        const int get_blocks_x() const { return blocks_x; }
+        const int get_blocks_y() const { return blocks_y; }
+
         const int get_width() { return width; }
         const int get_height() { return height; }
         const int get_tile_size() { return tile_size; }
 
+    private:
+        // clips the rectangle to the map, returns false when nothing is left
+        bool clip_rect(int& x0, int& y0, int& x1, int& y1) const;
+        void touch_rect(int x0, int y0, int x1, int y1);
+
     private:
         int width, height, tile_size;
-        std::vector<bool> collision_tiles;
+        int words_per_row;
+        std::vector<std::uint64_t> collision_words;
+        std::vector<std::uint8_t> terrain;
+        int blocks_x, blocks_y;
+        std::uint64_t revision;
+        std::vector<std::uint64_t> block_revisions;
 };
 
 #endif
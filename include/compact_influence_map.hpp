@@ -0,0 +1,85 @@
+#ifndef COMPACT_INFLUENCE_MAP_HPP
+#define COMPACT_INFLUENCE_MAP_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <collision_map.hpp>
+#include <propagation_kernel.hpp>
+#include <source_registry.hpp>
+#include <thread_pool.hpp>
+
+// InfluenceMap with 16-bit fixed-point buffers, half the memory and memory traffic of the float grids
+//
+// a tile stores round(value / scale) with scale = range / FIXED_MAX, range defaults to |strength| and
+// values beyond it saturate. the kernel widens a row to float, runs the same step as InfluenceMap on the
+// raw quanta and rounds the result back to nearest
+//
+// error against an InfluenceMap with the same parameters, for values within range, with c = exp(-decay)
+// and m = momentum:
+//     source stamps and a single step add at most half a quantum (0.5 * scale)
+//     a step shrinks any earlier difference by 1 - m * (1 - c), so the difference stays below
+//     0.5 * scale / (m * (1 - c)) for any number of steps, see get_error_bound()
+// this holds where one sign dominates, where fields of opposite sign meet with nearly equal magnitudes the
+// rounding can flip which one MAX_ABS picks, so the difference there can reach the size of the fields
+// the flip side of the bound is that tails weaker than it can stop decaying instead of fading to zero
+class CompactInfluenceMap {
+    public:
+        // range 0 uses |strength|
+        CompactInfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, float strength, float decay, float momentum,
+                bool collision_enabled = true, float range = 0.0f);
+
+        SourceHandle add_source(int tile_x, int tile_y, float source_strength);
+        SourceHandle add_source(int tile_x, int tile_y);
+        bool remove_source(SourceHandle handle);
+        bool move_source(SourceHandle handle, int tile_x, int tile_y);
+        bool set_source_strength(SourceHandle handle, float source_strength);
+        void clear_sources();
+
+        // steps the map once, row bands run on the pool when one is given
+        void recalculate(ThreadPool* pool = nullptr);
+
+        float get_influence(int tile_x, int tile_y) const;
+        // converts the whole grid into a plain width * height float grid
+        void copy_influence(std::vector<float>& out) const;
+
+        const std::string& get_name() const { return name; }
+        const int get_width() const { return width; }
+        const int get_height() const { return height; }
+        const float get_strength() const { return strength; }
+        const float get_decay() const { return decay; }
+        const float get_momentum() const { return momentum; }
+        const float get_range() const { return range; }
+        // value of one quantum
+        const float get_scale() const { return scale; }
+        // bound on the difference to the float map described above, infinite without momentum or decay
+        const float get_error_bound() const;
+        const SourceRegistry& get_sources() const { return sources; }
+        const std::uint64_t get_generation() const { return generation; }
+        // fixed-point values of the front buffer
+        const std::vector<std::int16_t>& get_values() const { return values; }
+
+    private:
+        void recalculate_rows(int first, int last);
+        std::int16_t quantize(float value) const;
+        bool on_map(int tile_x, int tile_y) const { return tile_x >= 0 && tile_y >= 0 && tile_x < width && tile_y < height; }
+
+    private:
+        std::string name;
+        std::shared_ptr<CollisionMap> collision_map;
+        bool collision_enabled;
+        int width, height;
+        float strength, decay, momentum;
+        float range, scale;
+        SourceRegistry sources;
+        // front and back buffers, the kernel reads the front and writes the back
+        std::vector<std::int16_t> values, buffer;
+        std::vector<std::int16_t> border_row;
+        std::uint64_t generation;
+        float step_coefficient;
+        PropagateFixedRowFn step_kernel;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef COMPOSITE_MAP_HPP
+#define COMPOSITE_MAP_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <influence_map.hpp>
+
+// expression over influence maps, built from layers and constants with the static functions below
+// copies are cheap and share their subexpressions
+//
+//     auto friendly = MapExpr::layer(friendly_map);
+//     auto enemy = MapExpr::layer(enemy_map);
+//     auto tension = MapExpr::add(friendly, enemy);
+//     auto vulnerability = MapExpr::sub(tension, MapExpr::abs(MapExpr::sub(friendly, enemy)));
+class MapExpr {
+    public:
+        enum class Op { LAYER, CONSTANT, ADD, SUB, MIN, MAX, SCALE, ABS, THRESHOLD };
+
+    public:
+        static MapExpr layer(std::shared_ptr<InfluenceMap> map);
+        static MapExpr constant(float value);
+        static MapExpr add(const MapExpr& a, const MapExpr& b);
+        static MapExpr sub(const MapExpr& a, const MapExpr& b);
+        static MapExpr min(const MapExpr& a, const MapExpr& b);
+        static MapExpr max(const MapExpr& a, const MapExpr& b);
+        static MapExpr scale(const MapExpr& a, float factor);
+        static MapExpr abs(const MapExpr& a);
+        // keeps values of at least threshold and zeroes the rest
+        static MapExpr threshold(const MapExpr& a, float threshold);
+
+    private:
+        struct Node {
+            Op op;
+            float value;
+            std::shared_ptr<InfluenceMap> map;
+            std::shared_ptr<const Node> a, b;
+        };
+
+        MapExpr(std::shared_ptr<const Node> node) : node(node) {}
+
+    private:
+        std::shared_ptr<const Node> node;
+
+        friend class CompositeMap;
+};
+
+// evaluates a MapExpr without temporary grids
+//
+// the expression is flattened into a short list of element wise instructions that run over one row
+// segment of at most SEGMENT tiles at a time, so every intermediate stays in a small scratch buffer
+// and the plain loops over it are vectorized by the compiler
+// whole grid results are cached until the generation of one of the input layers changes
+// every layer must be the same size, an expression over layers of different sizes is rejected when it is
+// bound: the map stays empty (0x0, every evaluation yields nothing) and is_bound() returns false
+// a CompositeMap is not safe to use from several threads at once
+class CompositeMap {
+    public:
+        static constexpr int SEGMENT = 256;
+
+    public:
+        CompositeMap(const MapExpr& expr);
+
+        // whole grid, recomputed only when an input layer changed since the last call
+        const std::vector<float>& evaluate();
+
+        // rect_width * rect_height values in row order, clipped to the grid (out is sized to the clipped rect)
+        // served from the cached grid when it is still current, computed directly otherwise
+        void evaluate_rect(int tile_x, int tile_y, int rect_width, int rect_height, std::vector<float>& out);
+
+        float get_value(int tile_x, int tile_y);
+
+        const int get_width() const { return width; }
+        const int get_height() const { return height; }
+        // false when the layers of the expression differ in size
+        const bool is_bound() const { return bound; }
+        bool is_cached() const;
+
+    private:
+        struct Instruction {
+            MapExpr::Op op;
+            int dst, a, b;
+            float value;
+            int layer;
+        };
+
+    private:
+        void compile(const MapExpr::Node& node, int depth);
+        void run_segment(std::size_t offset, int count, float* out);
+
+    private:
+        bool bound;
+        int width, height;
+        std::vector<Instruction> program;
+        // every distinct input map, LAYER instructions index into it
+        std::vector<std::shared_ptr<InfluenceMap>> layers;
+        int register_count;
+        std::vector<float> scratch;
+        std::vector<const float*> registers;
+
+        bool cache_valid;
+        std::vector<std::uint64_t> cached_generations;
+        std::vector<float> cache;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef INFLUENCE_FILE_HPP
+#define INFLUENCE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <collision_map.hpp>
+#include <influence_map.hpp>
+
+// binary snapshot of a collision map and the influence maps over it
+//
+// layout, all values in host byte order (the header records it and files from the other order are refused):
+//     FileHeader
+//     LayerHeader[layer_count]
+//     collision words, words_per_row * height uint64, exactly as CollisionMap stores them
+//     terrain classes, width * height bytes, only when the collision map has a terrain layer
+//     per layer: width * height floats (front buffer), then source_count FileSource entries,
+//     then TERRAIN_CLASSES floats of terrain costs
+// every section starts on a SECTION_ALIGNMENT boundary so it can be used in place from a mapping
+//
+// version 2 appended the fields from terrain_offset on to the headers, version 1 files are still read,
+// they have no terrain, every terrain class costs 1.0 and the maps use the default stencil
+namespace influence_file {
+
+const char MAGIC[8] = {'I', 'N', 'F', 'L', 'M', 'A', 'P', '\0'};
+const std::uint32_t VERSION = 2;
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+const std::size_t SECTION_ALIGNMENT = 64;
+const int NAME_LENGTH = 32;
+const int TERRAIN_CLASSES = 256;
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::int32_t width, height, tile_size;
+    std::uint32_t words_per_row;
+    std::uint32_t layer_count;
+    std::uint32_t reserved;
+    std::uint64_t collision_offset;
+    std::uint64_t file_size;
+    // version 2, 0 when there is no terrain layer
+    std::uint64_t terrain_offset;
+};
+
+struct LayerHeader {
+    char name[NAME_LENGTH];
+    float strength, decay, momentum;
+    std::uint32_t collision_enabled;
+    std::uint64_t values_offset;
+    std::uint64_t sources_offset;
+    std::uint64_t source_count;
+    // version 2, 0 when every class costs 1.0
+    std::uint64_t terrain_costs_offset;
+    // version 2, Stencil and CombineRule values and the weights of the WEIGHTED stencil
+    std::uint32_t stencil;
+    std::uint32_t combine_rule;
+    float stencil_weights[9];
+    std::uint32_t padding;
+};
+
+// sizes of the headers in version 1 files, everything before the version 2 fields
+const std::size_t FILE_HEADER_SIZE_V1 = offsetof(FileHeader, terrain_offset);
+const std::size_t LAYER_HEADER_SIZE_V1 = offsetof(LayerHeader, terrain_costs_offset);
+
+struct FileSource {
+    std::int32_t x, y;
+    float strength;
+};
+
+}
+
+// writes the collision map and every map over it in the current version, returns false if the file could
+// not be written, maps must all be built on collision_map
+bool save_influence_file(const std::string& path, CollisionMap& collision_map, const std::vector<std::shared_ptr<InfluenceMap>>& maps);
+
+// a saved file mapped into memory
+//
+// the mapping is private, so the views can be read and written in place without any copy and writes only
+// touch this process (pages are copied on their first write, the file never changes)
+// views stay valid for the lifetime of the MappedInfluenceFile
+// live maps are copied out of the mapping, they own their buffers (two per map, swapped every step) and
+// outlive the file, so loading them costs one bulk copy per section instead of parsing tile by tile
+// readers that only need the saved values can use the views and skip the copy
+class MappedInfluenceFile {
+    public:
+        // maps the file and checks the header and every section against its size, nullptr on failure
+        // files with a tile size below 1, sources off the map or unknown stencils are refused as well
+        static std::unique_ptr<MappedInfluenceFile> open(const std::string& path);
+        ~MappedInfluenceFile();
+
+        MappedInfluenceFile(const MappedInfluenceFile&) = delete;
+        MappedInfluenceFile& operator=(const MappedInfluenceFile&) = delete;
+
+        const int get_version() const { return static_cast<int>(header.version); }
+        const int get_width() const { return header.width; }
+        const int get_height() const { return header.height; }
+        const int get_tile_size() const { return header.tile_size; }
+        const int get_layer_count() const { return static_cast<int>(header.layer_count); }
+        // headers of older versions are widened, the fields they lack read as 0
+        const influence_file::LayerHeader& get_layer_header(int layer) const { return layers[layer]; }
+        std::string get_layer_name(int layer) const;
+
+        // zero-copy views into the mapping
+        std::uint64_t* get_collision_words() { return reinterpret_cast<std::uint64_t*>(data + header.collision_offset); }
+        float* get_layer_values(int layer) { return reinterpret_cast<float*>(data + layers[layer].values_offset); }
+        const influence_file::FileSource* get_layer_sources(int layer) const {
+            return reinterpret_cast<const influence_file::FileSource*>(data + layers[layer].sources_offset);
+        }
+        // null when the file has no terrain layer
+        const std::uint8_t* get_terrain() const {
+            return header.terrain_offset != 0 ? reinterpret_cast<const std::uint8_t*>(data + header.terrain_offset) : nullptr;
+        }
+        // TERRAIN_CLASSES costs, null when the file has none for the layer
+        const float* get_layer_terrain_costs(int layer) const {
+            return layers[layer].terrain_costs_offset != 0 ? reinterpret_cast<const float*>(data + layers[layer].terrain_costs_offset) : nullptr;
+        }
+
+        // live objects copied out of the mapping, with every saved setting
+        std::shared_ptr<CollisionMap> copy_collision_map();
+        // every saved source comes back, in the saved order, the first source on a tile is added through
+        // add_influence so remove_influence finds it, any others on the same tile as handle based sources
+        std::shared_ptr<InfluenceMap> copy_influence_map(int layer, std::shared_ptr<CollisionMap> collision_map);
+
+    private:
+        MappedInfluenceFile(char* data, std::size_t size);
+        bool read_headers();
+        bool validate() const;
+
+    private:
+        char* data;
+        std::size_t size;
+        // copied out of the mapping and widened to the current version
+        influence_file::FileHeader header;
+        std::vector<influence_file::LayerHeader> layers;
+};
+
+#endif
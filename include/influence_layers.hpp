@@ -0,0 +1,84 @@
+#ifndef INFLUENCE_LAYERS_HPP
+#define INFLUENCE_LAYERS_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <collision_map.hpp>
+#include <propagation_kernel.hpp>
+#include <source_registry.hpp>
+#include <thread_pool.hpp>
+
+// several influence layers over one collision map, stepped together in a single pass over the grid
+//
+// values are interleaved per tile: tile i holds its layers at [stride * i, stride * i + layer_count),
+// stride is the layer count padded to the narrowest vector that holds it (1, 4 or 8 lanes) and to whole
+// LAYER_LANE_ALIGNMENT vectors past that, so every tile is a whole number of vectors and each layer sits
+// in its own lane with its own coefficient and momentum
+// padding lanes cost memory and bandwidth like real layers: 3 layers take 4 floats per tile and buffer,
+// 9 layers take 16, the kernel drops to the vector width that divides the stride (sse2 at 4, scalar at 1)
+// so a single layer is better off as an InfluenceMap
+// every layer propagates exactly like an InfluenceMap with the same parameters would
+class InfluenceLayers {
+    public:
+        InfluenceLayers(std::shared_ptr<CollisionMap> collision_map, bool collision_enabled = true);
+
+        // returns the index of the new layer, values of existing layers are kept
+        int add_layer(std::string name, float strength, float decay, float momentum);
+
+        SourceHandle add_source(int layer, int tile_x, int tile_y, float source_strength);
+        SourceHandle add_source(int layer, int tile_x, int tile_y);
+        bool remove_source(int layer, SourceHandle handle);
+        bool move_source(int layer, SourceHandle handle, int tile_x, int tile_y);
+        void clear_sources(int layer);
+
+        void set_decay(int layer, float decay);
+        void set_momentum(int layer, float momentum);
+
+        // steps every layer once, row bands run on the pool when one is given
+        void recalculate(ThreadPool* pool = nullptr);
+
+        float get_influence(int layer, int tile_x, int tile_y) const;
+        // copies one layer out into a plain width * height grid
+        void copy_layer(int layer, std::vector<float>& out) const;
+
+        const int get_width() const { return width; }
+        const int get_height() const { return height; }
+        const int get_layer_count() const { return static_cast<int>(layers.size()); }
+        const int get_stride() const { return stride; }
+        const std::string& get_layer_name(int layer) const { return layers[layer].name; }
+        const float get_strength(int layer) const { return layers[layer].strength; }
+        const float get_decay(int layer) const { return layers[layer].decay; }
+        const float get_momentum(int layer) const { return layers[layer].momentum; }
+        const SourceRegistry& get_sources(int layer) const { return layers[layer].sources; }
+        // interleaved values of the front buffer, stride floats per tile
+        const std::vector<float>& get_values() const { return values; }
+
+    private:
+        struct Layer {
+            std::string name;
+            float strength, decay, momentum;
+            SourceRegistry sources;
+        };
+
+    private:
+        void recalculate_rows(int first, int last);
+        void update_lanes();
+        bool on_map(int tile_x, int tile_y) const { return tile_x >= 0 && tile_y >= 0 && tile_x < width && tile_y < height; }
+
+    private:
+        std::shared_ptr<CollisionMap> collision_map;
+        bool collision_enabled;
+        int width, height;
+        int stride;
+        std::vector<Layer> layers;
+        // front and back buffers, the kernel reads the front and writes the back
+        std::vector<float> values, buffer;
+        std::vector<float> border_row;
+        // per lane parameters, padding lanes have zero coefficient and momentum and stay zero
+        std::vector<float> lane_coefficients, lane_momentums;
+        PropagateLayersRowFn step_kernel;
+};
+
+#endif
@@ -1,23 +1,99 @@
 #ifndef INFLUENCE_MAP_HPP
 #define INFLUENCE_MAP_HPP
 
-#include <list>
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <memory>
+#include <unordered_map>
 
 #include <collision_map.hpp>
+#include <profiler.hpp>
+#include <propagation_kernel.hpp>
+#include <source_registry.hpp>
+
+struct SourceMove {
+    SourceHandle handle;
+    int tile_x, tile_y;
+};
 
 class InfluenceMap {
     public:
         InfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, float strength, float decay, float momentum, bool collision_enabled = true);
 
-        void add_influence(int tile_x, int tile_y);
+        // one source per tile, adding to a tile that already has one updates its strength
+        // the strength defaults to the strength of the map
+        // moving one of these sources with move_source moves its tile entry along, so remove_influence finds it
+        // at the new tile, unless that tile already has an entry of its own
+        SourceHandle add_influence(int tile_x, int tile_y);
+        SourceHandle add_influence(int tile_x, int tile_y, float source_strength);
         void remove_influence(int tile_x, int tile_y);
+
+        // handle based sources, any number of them may share a tile, the last one stamped wins
+        // all of these are O(1) and return false (or a null handle) for stale handles or tiles off the map
+        SourceHandle add_source(int tile_x, int tile_y, float source_strength);
+        bool remove_source(SourceHandle handle);
+        bool move_source(SourceHandle handle, int tile_x, int tile_y);
+        bool set_source_strength(SourceHandle handle, float source_strength);
+        void move_sources(const std::vector<SourceMove>& moves);
+        void clear_sources();
         void set_collision(bool enabled);
 
+        // overwrites one tile in both buffers, for seeding a map from outside data
+        void set_influence(int tile_x, int tile_y, float value);
+        // same for the whole grid, values holds width * height floats in row order
+        void assign_influence(const float* values);
+
+        // incremental mode only processes blocks of CollisionMap::BLOCK_SIZE tiles that changed by
+        // more than epsilon last step, their neighbors, and blocks woken by sources or collision edits
+        // a block has to be quiet for two steps (one per buffer) before it goes to sleep
+        void set_incremental(bool enabled, float epsilon = 1e-4f);
+
+        // neighborhood and combine rule of the propagation, 4 neighbors with MAX_ABS by default
+        // every combination runs its own specialized kernel
+        void set_stencil(Stencil stencil, CombineRule rule = CombineRule::MAX_ABS);
+        // 3x3 weights of the WEIGHTED stencil in row order, the center is ignored, all ones by default
+        // each neighbor gets exp(-decay) times its weight
+        // valid weights lie in [0, exp(decay * c)] with c the lowest terrain cost (1.0 without terrain), there no
+        // neighbor passes on more than it holds, weights outside are clamped into the range when a step runs
+        // since a larger one would let MAX_ABS and SIGNED_MAX grow without bound
+        void set_stencil_weights(const std::array<float, 9>& weights);
+
+        // cost of entering a tile of a terrain class of the collision map, open ground is 1.0
+        // 2.0 makes a forest tile take as much influence as two plain tiles, 0.5 lets a road carry it twice as far
+        // every class costs 1.0 until set, negative costs are clamped to zero
+        // the factor per class is computed here once, a step only looks it up per tile
+        void set_terrain_cost(std::uint8_t terrain_class, float cost);
+        const float get_terrain_cost(std::uint8_t terrain_class) const { return terrain_costs[terrain_class]; }
+
         void recalculate();
 
+        // jumps straight to the converged field instead of spreading one tile per step
+        // every tile gets strength * exp(-decay * distance) of its strongest source, with distance measured
+        // around walls, positive and negative sources compete the same way recalculate() does
+        // distances take diagonal steps of sqrt(2) for 8 neighbor stencils and entering a tile adds its terrain
+        // cost minus one, the result is exact for the FOUR and EIGHT stencils with MAX_ABS and an approximation
+        // for the other stencils and rules
+        // both buffers are overwritten so recalculate() carries on smoothly from the result
+        void solve_steady_state();
+
+        // recalculate() split into phases so rows can be spread over several threads
+        // begin and end must run alone, row ranges of the same step may run concurrently
+        // between begin and end the front buffer also holds the stamped sources
+        // in incremental mode concurrent row ranges must start on a block boundary
+        void begin_recalculate();
+        void recalculate_rows(int first_row, int last_row);
+        void end_recalculate();
+
+        // hash of the values returned by get_influence_map, equal to hash_grid() of them, for desync checks
+        // only blocks written since the last call are rehashed, every buffer keeps its own block hashes since
+        // an active block of an incremental map holds different values in the two buffers
+        // must not be called between begin_recalculate and end_recalculate
+        std::uint64_t get_state_hash();
+        // block hashes behind the last get_state_hash(), comparing them between peers finds the blocks that differ
+        const std::vector<std::uint64_t>& get_block_hashes() const { return block_hashes[front_buffer]; }
+
         const std::string& get_name() const { return name; }
         const std::vector<float>& get_influence_map() const { return influence_map; }
         const int get_width() { return collision_map->get_width(); }
@@ -26,19 +102,103 @@ class InfluenceMap {
         const float get_strength() { return strength; }
         const float get_decay() { return decay; }
         const float get_momentum() { return momentum; }
+        const SourceRegistry& get_sources() const { return influence_sources; }
+        // bumped whenever the values returned by get_influence_map change
+        const std::uint64_t get_generation() const { return generation; }
+        // generation of the last change to the values of a CollisionMap::BLOCK_SIZE block, a block is unchanged
+        // since generation g while this is at most g, so readers only redo the blocks that changed
+        // in incremental mode only active blocks change, a block that goes to sleep gets its values copied into
+        // the back buffer so the swaps no longer alternate between the last two steps
+        const std::uint64_t get_block_generation(int block_x, int block_y) const { return block_generations[blocks_x * block_y + block_x]; }
+        const int get_blocks_x() const { return blocks_x; }
+        const int get_blocks_y() const { return blocks_y; }
+        const Stencil get_stencil() const { return stencil; }
+        const CombineRule get_combine_rule() const { return combine_rule; }
+        const std::array<float, 9>& get_stencil_weights() const { return stencil_weights; }
+        const bool is_collision_enabled() const { return collision_enabled; }
+        const bool is_incremental() const { return incremental; }
+        const int get_active_block_count() const { return active_block_count; }
+
+        // counters of the update phases and of the InfluenceQuery queries on this map, they only exist in
+        // builds with INFLUENCE_PROFILING and read as zero otherwise
+#ifdef INFLUENCE_PROFILING
+        const ProfileStats get_profile_stats() const { return profile.get_stats(); }
+        void reset_profile() { profile.reset(); }
+        ProfileCounters& get_profile_counters() { return profile; }
+#else
+        const ProfileStats get_profile_stats() const { return {}; }
+        void reset_profile() {}
+#endif
 
     private:
-        struct InfluenceSource {
-            int x, y;
-        };
+        void wake_block(int block_x, int block_y);
+        void wake_tile(int tile_x, int tile_y);
+        void wake_all();
+        bool on_map(int tile_x, int tile_y);
+        // returns true when handle owned the tile entry
+        bool forget_tile_source(SourceHandle handle, const InfluenceSource& src);
+        float block_delta(int block_x, int block_y) const;
+        void solve_distances(bool positive, std::vector<float>& values);
+        void update_stencil_coefficients();
+        void invalidate_hashes();
+        void touch_block(int block_x, int block_y);
+        void copy_block_to_back(int block_x, int block_y);
+        void propagate_span(const float* up, const float* mid, const float* down, const std::uint64_t* blocked,
+                const std::uint8_t* terrain, float* out, int first, int last, int width);
+        void propagate_rows(int first_row, int last_row);
+#ifdef INFLUENCE_PROFILING
+        // compares the rows just written with the ones they were computed from, outside the propagate scope
+        void count_changed_rows(int first_row, int last_row);
+#endif
 
     private:
         std::string name;
         float strength, decay, momentum;
         bool collision_enabled;
         std::shared_ptr<CollisionMap> collision_map;
-        std::list<InfluenceSource> influence_sources;
+        SourceRegistry influence_sources;
+        // sources created through add_influence, keyed by tile index
+        std::unordered_map<int, SourceHandle> tile_sources;
+        // front (last completed step, returned by get_influence_map) and back buffer, swapped every step
         std::vector<float> influence_map, influence_buffer;
+        std::vector<float> border_row;
+        std::uint64_t generation;
+        float step_coefficient;
+        PropagateRowFn step_kernel;
+
+        // stencil settings, the stencil kernel is null while the default 4 neighbor kernel runs
+        Stencil stencil;
+        CombineRule combine_rule;
+        std::array<float, 9> stencil_weights;
+        std::array<float, STENCIL_NEIGHBORS> step_coefficients;
+        PropagateStencilRowFn step_stencil_kernel;
+
+        // terrain settings, coefficients hold exp(-decay * (cost - 1)) per class and scale the stencil coefficients
+        std::array<float, 256> terrain_costs;
+        std::array<float, 256> terrain_coefficients;
+        bool step_terrain;
+
+        // incremental mode state, one entry per block
+        bool incremental;
+        float epsilon;
+        int blocks_x, blocks_y;
+        int active_block_count;
+        std::uint64_t collision_revision;
+        std::vector<std::uint8_t> block_countdown, block_active, block_row_active, block_has_source;
+        std::vector<float> block_deltas;
+        std::vector<float> stamped_values;
+        // generation of the last change per block, in every mode
+        std::vector<std::uint64_t> block_generations;
+
+#ifdef INFLUENCE_PROFILING
+        ProfileCounters profile;
+#endif
+
+        // state hash per physical buffer, front_buffer tells which one influence_map currently holds
+        int front_buffer;
+        std::array<std::vector<std::uint64_t>, 2> block_hashes;
+        std::array<std::vector<std::uint8_t>, 2> block_hash_dirty;
+        std::array<std::uint64_t, 2> state_hashes;
 };
 
 #endif
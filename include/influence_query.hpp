@@ -0,0 +1,94 @@
+#ifndef INFLUENCE_QUERY_HPP
+#define INFLUENCE_QUERY_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <influence_map.hpp>
+#include <thread_pool.hpp>
+
+struct QueryResult {
+    // tile_x and tile_y are -1 when the queried area holds no tile
+    int tile_x, tile_y;
+    float value;
+};
+
+// highest (or lowest) count tiles within radius tiles (euclidean) of a center, for batched queries
+struct RadiusQuery {
+    int center_x, center_y;
+    int radius;
+    int count;
+    bool lowest;
+};
+
+// area queries over one InfluenceMap
+//
+// keeps a summed-area table for O(1) area sums and a min/max pyramid (every level halves both sides)
+// that argmax/argmin and top-k searches walk best first: a cell is only opened when its bound can still
+// beat the results found so far, so a query touches about log(area) cells unless the field is flat
+// the structures are rebuilt lazily on the first query after the map's generation changed, only for the
+// blocks of the map that changed since: the sums from the first changed row down and the pyramid cells above
+// the changed blocks, so a mostly asleep incremental map costs little to keep queryable
+// queries refresh on their own and are not thread-safe, run_batch refreshes once and then spreads the
+// queries over the pool
+class InfluenceQuery {
+    public:
+        InfluenceQuery(std::shared_ptr<InfluenceMap> map);
+
+        // updates the tables for the blocks the map changed since the last refresh
+        void refresh();
+
+        // sum and mean of the values in the rect, clipped to the map
+        double area_sum(int tile_x, int tile_y, int rect_width, int rect_height);
+        float area_mean(int tile_x, int tile_y, int rect_width, int rect_height);
+
+        QueryResult argmax_rect(int tile_x, int tile_y, int rect_width, int rect_height);
+        QueryResult argmin_rect(int tile_x, int tile_y, int rect_width, int rect_height);
+        QueryResult argmax_radius(int center_x, int center_y, int radius);
+        QueryResult argmin_radius(int center_x, int center_y, int radius);
+
+        // up to count tiles ordered from the best, fewer when the area is smaller
+        void top_k_rect(int tile_x, int tile_y, int rect_width, int rect_height, int count, bool lowest, std::vector<QueryResult>& out);
+        void top_k_radius(int center_x, int center_y, int radius, int count, bool lowest, std::vector<QueryResult>& out);
+
+        // answers every query into out[i], out keeps its allocations between calls
+        void run_batch(const std::vector<RadiusQuery>& queries, std::vector<std::vector<QueryResult>>& out, ThreadPool* pool = nullptr);
+
+        const std::shared_ptr<InfluenceMap>& get_map() const { return map; }
+
+    private:
+        // the area a search is limited to, either a rect or a disc
+        struct Region {
+            int x0, y0, x1, y1;
+            bool disc;
+            int center_x, center_y;
+            long long radius_squared;
+        };
+
+    private:
+        void refresh_sums(int first_row);
+        void refresh_dirty_cells();
+        void rebuild_cell(int level, int cell_x, int cell_y);
+        void search(const Region& region, int count, bool lowest, std::vector<QueryResult>& out) const;
+        bool intersects(const Region& region, int level, int cell_x, int cell_y) const;
+        float cell_bound(int level, int cell_x, int cell_y, bool lowest) const;
+        Region rect_region(int tile_x, int tile_y, int rect_width, int rect_height) const;
+        Region disc_region(int center_x, int center_y, int radius) const;
+
+    private:
+        std::shared_ptr<InfluenceMap> map;
+        int width, height;
+        bool built;
+        std::uint64_t built_generation;
+        // (width + 1) * (height + 1), entry (x, y) is the sum of every tile above and left of it
+        std::vector<double> sums;
+        // level 0 is the map itself, level l covers 2^l by 2^l tiles per cell
+        std::vector<std::vector<float>> max_levels, min_levels;
+        std::vector<int> level_widths, level_heights;
+        // scratch of refresh(): changed blocks of the map, cells of one level to rebuild and their marks
+        std::vector<int> dirty_blocks, dirty_cells;
+        std::vector<std::uint8_t> cell_marks;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LOCKSTEP_SCHEDULER_HPP
+#define LOCKSTEP_SCHEDULER_HPP
+
+#include <cstdint>
+#include <functional>
+
+// fixed timestep clock for the simulation, independent of how often the caller gets to run
+//
+// the caller reports the real time that passed, every full tick_seconds of it becomes one tick, so a stalled
+// frame is followed by several ticks instead of a late one, ticks are never skipped or merged since lockstep
+// peers and replays have to run exactly the same sequence
+// at most max_ticks_per_update ticks run per update so a long stall is caught up over several frames instead
+// of freezing one, the ticks still owed are reported by get_pending_ticks()
+// time is kept in whole nanoseconds so the tick count does not drift however long the session runs
+class LockstepScheduler {
+    public:
+        LockstepScheduler(double tick_seconds, int max_ticks_per_update = 8);
+
+        // adds elapsed_seconds and runs step(tick) for every tick that is due, up to max_ticks_per_update
+        // returns the number of ticks run
+        int update(double elapsed_seconds, const std::function<void(std::uint64_t)>& step);
+
+        // forgets the owed time and the tick count, for starting a new session or replay
+        void reset();
+
+        const double get_tick_seconds() const { return tick_nanoseconds * 1e-9; }
+        const int get_max_ticks_per_update() const { return max_ticks_per_update; }
+        // number of ticks run so far, the next step gets this as its tick
+        const std::uint64_t get_tick() const { return tick; }
+        // full ticks owed after the last update, above zero while catching up
+        const std::uint64_t get_pending_ticks() const { return accumulated / tick_nanoseconds; }
+        // progress into the next tick in [0, 1) once caught up, for interpolating between the last two states
+        const double get_alpha() const;
+
+    private:
+        std::int64_t tick_nanoseconds;
+        int max_ticks_per_update;
+        std::int64_t accumulated;
+        std::uint64_t tick;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MAP_RENDERER_HPP
+#define MAP_RENDERER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_primitives.h>
+
+#include <collision_map.hpp>
+#include <influence_map.hpp>
+
+// top left corner of the view in world pixels and screen pixels per world pixel
+struct Camera {
+    static constexpr float MIN_ZOOM = 1.0f / 32.0f;
+    static constexpr float MAX_ZOOM = 8.0f;
+
+    float x, y;
+    float zoom;
+
+    float to_world_x(float screen_x) const { return x + screen_x / zoom; }
+    float to_world_y(float screen_y) const { return y + screen_y / zoom; }
+    float to_screen_x(float world_x) const { return (world_x - x) * zoom; }
+    float to_screen_y(float world_y) const { return (world_y - y) * zoom; }
+
+    // changes the zoom while keeping the world point under the screen position in place
+    void zoom_at(float screen_x, float screen_y, float factor);
+};
+
+// draws the maps of the demo with a handful of draw calls however many tiles are on screen
+//
+// collision and influence are kept in textures of one texel per tile and drawn as one scaled quad each,
+// a texture is only written where the map changed since the last upload (blocks with a newer revision for
+// collision, blocks whose generation is past the generation of the last upload for influence), the grid is a
+// single line list for the visible tiles and value labels are only drawn once tiles are large enough on screen
+// to read them
+// the textures need the display, so they are made on the first draw and must be released with reset()
+// before the display is destroyed
+class MapRenderer {
+    public:
+        // screen size of a tile from which on the grid and the labels are drawn
+        static constexpr float GRID_MIN_TILE_PIXELS = 6.0f;
+        static constexpr float LABEL_MIN_TILE_PIXELS = 40.0f;
+        // influence below this is neither colored nor labeled
+        static constexpr float MIN_VISIBLE_INFLUENCE = 0.1f;
+
+    public:
+        MapRenderer(ALLEGRO_FONT* font);
+        ~MapRenderer();
+
+        MapRenderer(const MapRenderer&) = delete;
+        MapRenderer& operator=(const MapRenderer&) = delete;
+
+        void draw_collision_map(std::shared_ptr<CollisionMap> map, const Camera& camera, int screen_width, int screen_height);
+        void draw_influence_map(std::shared_ptr<InfluenceMap> map, const Camera& camera, int screen_width, int screen_height);
+
+        // destroys the textures, they are rebuilt by the next draw
+        void reset();
+
+        // rows written to the influence texture by the last draw_influence_map, 0 when nothing changed
+        const int get_uploaded_rows() const { return uploaded_rows; }
+
+    private:
+        // tiles [x0, x1) x [y0, y1) intersect the screen
+        struct VisibleTiles {
+            int x0, y0, x1, y1;
+        };
+
+        VisibleTiles visible_tiles(int width, int height, int tile_size, const Camera& camera, int screen_width, int screen_height) const;
+        void draw_layer(ALLEGRO_BITMAP* texture, int tile_size, const Camera& camera);
+        void draw_grid(const VisibleTiles& visible, int tile_size, const Camera& camera);
+        // full rewrites the whole texture, otherwise only what changed since the last upload
+        void upload_collision(CollisionMap& map, bool full);
+        void upload_influence(InfluenceMap& map, bool full);
+
+    private:
+        ALLEGRO_FONT* font;
+
+        ALLEGRO_BITMAP* collision_texture;
+        std::weak_ptr<CollisionMap> collision_source;
+        std::uint64_t collision_revision;
+
+        ALLEGRO_BITMAP* influence_texture;
+        std::weak_ptr<InfluenceMap> influence_source;
+        // generation of the map at the last upload, blocks changed after it are uploaded again
+        std::uint64_t influence_generation;
+        int uploaded_rows;
+
+        std::vector<ALLEGRO_VERTEX> grid_vertices;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef PARALLEL_UPDATE_HPP
+#define PARALLEL_UPDATE_HPP
+
+#include <memory>
+#include <vector>
+
+#include <influence_map.hpp>
+#include <thread_pool.hpp>
+
+// recalculates every map in a single batch on the pool, each grid is cut into bands of rows
+// holding roughly tiles_per_task tiles
+// a band only reads the previous step plus one halo row above and below, so the result is
+// identical to calling recalculate() on each map in turn
+void recalculate_parallel(ThreadPool& pool, const std::vector<std::shared_ptr<InfluenceMap>>& maps, int tiles_per_task = 65536);
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// instrumentation of the update and query paths
+//
+// the counters and scopes below only record anything when INFLUENCE_PROFILING is defined (cmake option
+// INFLUENCE_MAPS_PROFILING), without it the INFLUENCE_PROFILE_* macros expand to nothing so the hot paths
+// carry no timing calls, no extra passes and no atomics, and the maps hold no counters, the types stay
+// available so code reading the stats builds either way and simply sees zeros
+//
+// in profiling builds every map owns a ProfileCounters, phase times are summed over all threads that worked on
+// the phase, so with a pool the propagate time is cpu time and can exceed the wall time of the step
+// while a trace is running every scope is also recorded as a complete event for chrome://tracing or Perfetto
+
+enum class ProfilePhase {
+    STAMP,
+    PROPAGATE,
+    SWAP,
+    QUERY
+};
+
+const int PROFILE_PHASE_COUNT = 4;
+
+const char* get_profile_phase_name(ProfilePhase phase);
+
+// plain copy of the counters
+struct ProfileStats {
+    std::uint64_t steps;
+    std::uint64_t tiles_processed;
+    // tiles whose value differs from the previous step
+    std::uint64_t tiles_changed;
+    std::uint64_t sources_stamped;
+    std::uint64_t queries;
+    std::array<std::uint64_t, PROFILE_PHASE_COUNT> phase_nanoseconds;
+    std::array<std::uint64_t, PROFILE_PHASE_COUNT> phase_calls;
+
+    const double get_phase_milliseconds(ProfilePhase phase) const { return phase_nanoseconds[static_cast<int>(phase)] * 1e-6; }
+};
+
+// counters of one map, safe to add to from several threads at once
+class ProfileCounters {
+    public:
+        ProfileCounters();
+
+        void add_steps(std::uint64_t count) { steps.fetch_add(count, std::memory_order_relaxed); }
+        void add_tiles(std::uint64_t processed, std::uint64_t changed);
+        void add_sources_stamped(std::uint64_t count) { sources_stamped.fetch_add(count, std::memory_order_relaxed); }
+        void add_queries(std::uint64_t count) { queries.fetch_add(count, std::memory_order_relaxed); }
+        void add_phase_time(ProfilePhase phase, std::uint64_t nanoseconds);
+
+        ProfileStats get_stats() const;
+        void reset();
+
+    private:
+        std::atomic<std::uint64_t> steps, tiles_processed, tiles_changed, sources_stamped, queries;
+        std::array<std::atomic<std::uint64_t>, PROFILE_PHASE_COUNT> phase_nanoseconds, phase_calls;
+};
+
+// one complete event of a trace, times in nanoseconds since the trace started
+struct TraceEvent {
+    std::string name;
+    // the map the event belongs to, empty for events of the application
+    std::string detail;
+    std::uint64_t start, duration;
+    int thread;
+};
+
+// the trace is process wide, scopes record into it from any thread while it runs
+// events beyond max_events are dropped so a forgotten trace cannot eat all memory
+void start_trace(std::size_t max_events = 1 << 20);
+void stop_trace();
+bool is_tracing();
+// events recorded since the trace started, also after it stopped
+std::vector<TraceEvent> get_trace_events();
+std::size_t get_dropped_trace_events();
+// writes the events in the chrome trace event format, returns false when the file cannot be written
+bool write_chrome_trace(const std::string& path);
+
+// times the enclosing scope, adds it to counters (when not null) and records a trace event
+// name and detail must outlive the scope
+class ProfileScope {
+    public:
+        ProfileScope(ProfileCounters* counters, ProfilePhase phase, const char* name, const std::string* detail = nullptr);
+        // trace only, for phases of the application that belong to no map
+        explicit ProfileScope(const char* name);
+        ~ProfileScope();
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+    private:
+        ProfileCounters* counters;
+        ProfilePhase phase;
+        const char* name;
+        const std::string* detail;
+        std::uint64_t start;
+};
+
+// number of tiles in [first, last) whose value changed between before and after
+inline std::uint64_t count_changed_tiles(const float* before, const float* after, int first, int last) {
+    std::uint64_t changed = 0;
+    for (int x = first; x < last; ++x) {
+        changed += before[x] != after[x];
+    }
+    return changed;
+}
+
+#define INFLUENCE_PROFILE_CONCAT_INNER(a, b) a##b
+#define INFLUENCE_PROFILE_CONCAT(a, b) INFLUENCE_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef INFLUENCE_PROFILING
+#define INFLUENCE_PROFILE_SCOPE(counters, phase, name, detail) \
+    ProfileScope INFLUENCE_PROFILE_CONCAT(profile_scope_, __LINE__)(&(counters), phase, name, &(detail))
+#define INFLUENCE_TRACE_SCOPE(name) ProfileScope INFLUENCE_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+// statement form, the arguments are not evaluated at all when profiling is off
+#define INFLUENCE_PROFILE(statement) statement
+#else
+#define INFLUENCE_PROFILE_SCOPE(counters, phase, name, detail) ((void)0)
+#define INFLUENCE_TRACE_SCOPE(name) ((void)0)
+#define INFLUENCE_PROFILE(statement) ((void)0)
+#endif
+
+#endif
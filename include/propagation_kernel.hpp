@@ -0,0 +1,83 @@
+#ifndef PROPAGATION_KERNEL_HPP
+#define PROPAGATION_KERNEL_HPP
+
+#include <cstdint>
+
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+// propagates tiles [first, last) of one row of influence from the previous step into out
+// width is the full row width, pointers are to the start of the row
+// up and down point at a row of zeros on the grid border, blocked is the row of collision
+// words from CollisionMap::get_row_words or null when collision is disabled
+using PropagateRowFn = void (*)(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum);
+
+// PropagateRowFn over int16 fixed-point values, each step is computed in float and rounded to nearest
+// the kernel never sees the fixed-point scale, every operation of a step commutes with scaling
+using PropagateFixedRowFn = void (*)(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum);
+
+// largest fixed-point magnitude, results saturate to +-FIXED_MAX so negating a value never overflows
+const float FIXED_MAX = 32767.0f;
+
+// neighborhood a tile takes its influence from
+// FOUR: up, down, left, right at distance 1
+// EIGHT: FOUR plus the diagonals at distance sqrt(2)
+// WEIGHTED: all eight neighbors, each scaled by its own weight of a 3x3 kernel
+enum class Stencil {
+    FOUR,
+    EIGHT,
+    WEIGHTED
+};
+
+// how the decayed neighbors turn into the value a tile moves towards
+// MAX_ABS: the strongest neighbor, positive or negative
+// AVERAGE: the weighted mean of the neighbors
+// SIGNED_MAX: the strongest positive plus the strongest negative neighbor, so opposing influence cancels
+enum class CombineRule {
+    MAX_ABS,
+    AVERAGE,
+    SIGNED_MAX
+};
+
+// coefficient count of the stencil kernels, in the order up, down, left, right, up left, up right,
+// down left, down right
+const int STENCIL_NEIGHBORS = 8;
+
+// terrain is the row of 8-bit terrain classes from CollisionMap::get_terrain_row and terrain_coefficients
+// a table of 256 factors indexed by class, both are only read by the kernels selected with terrain set
+using PropagateStencilRowFn = void (*)(const float* up, const float* mid, const float* down, const std::uint64_t* blocked,
+        const std::uint8_t* terrain, const float* terrain_coefficients, float* out, int first, int last, int width,
+        const float* coefficients, float momentum);
+
+// multi-layer version, every tile holds stride floats (stride a multiple of the vector width of the level)
+// and every lane has its own coefficient and momentum
+using PropagateLayersRowFn = void (*)(const float* up, const float* mid, const float* down, const std::uint64_t* blocked,
+        float* out, int first, int last, int width, int stride, const float* coefficients, const float* momentums);
+
+// widest vector of any kernel, layer strides wider than one vector are padded to a multiple of it
+const int LAYER_LANE_ALIGNMENT = 8;
+
+// best level supported by the running cpu
+SimdLevel detect_simd_level();
+
+// level used by InfluenceMap, defaults to the detected level unless overridden by
+// the INFLUENCE_SIMD environment variable (scalar, sse2 or avx2)
+SimdLevel get_simd_level();
+
+// forces a lower level, mostly for testing and benchmarking; clamped to the detected level
+void set_simd_level(SimdLevel level);
+
+const char* get_simd_level_name(SimdLevel level);
+// floats per vector of the level's kernels
+const int get_simd_width(SimdLevel level);
+PropagateRowFn get_propagate_row(SimdLevel level);
+PropagateFixedRowFn get_propagate_fixed_row(SimdLevel level);
+PropagateLayersRowFn get_propagate_layers_row(SimdLevel level);
+PropagateStencilRowFn get_propagate_stencil_row(SimdLevel level, Stencil stencil, CombineRule rule, bool terrain = false);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SOURCE_REGISTRY_HPP
+#define SOURCE_REGISTRY_HPP
+
+#include <cstdint>
+#include <vector>
+
+// stable reference to a source, stays valid until the source is removed
+// a default constructed handle never refers to anything
+struct SourceHandle {
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0;
+
+    bool operator==(const SourceHandle&) const = default;
+};
+
+struct InfluenceSource {
+    int x, y;
+    float strength;
+};
+
+// dense pool of influence sources with O(1) add, remove and lookup through handles
+// sources are kept contiguous for the stamping loop, removal moves the last source into the gap
+class SourceRegistry {
+    public:
+        SourceHandle add(int x, int y, float strength);
+        bool remove(SourceHandle handle);
+        void clear();
+
+        // null when the handle is stale
+        InfluenceSource* get(SourceHandle handle);
+        const InfluenceSource* get(SourceHandle handle) const;
+
+        const std::vector<InfluenceSource>& get_sources() const { return sources; }
+        const std::size_t size() const { return sources.size(); }
+
+    private:
+        struct Slot {
+            std::uint32_t dense_index;
+            std::uint32_t generation;
+        };
+
+    private:
+        std::vector<InfluenceSource> sources;
+        std::vector<std::uint32_t> dense_slots;
+        std::vector<Slot> slots;
+        std::vector<std::uint32_t> free_slots;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef STATE_HASH_HPP
+#define STATE_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// hashes for comparing simulation state between lockstep peers and replays
+//
+// a grid is hashed per CollisionMap::BLOCK_SIZE block with XXH64 seeded by the block index, the hash of the
+// grid is the xor of its block hashes so it can be kept up to date by rehashing only the blocks that changed
+// values are hashed as their raw float bits in little endian order, the byte order of every platform we
+// ship on, so -0.0 and 0.0 hash differently like any other bit difference
+
+// XXH64 of size bytes, matches the reference implementation
+std::uint64_t xxhash64(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+// hash of one block of a width * height grid of floats in row order
+std::uint64_t hash_grid_block(const float* values, int width, int height, int block_x, int block_y);
+
+// hash of the whole grid, the xor of all block hashes
+std::uint64_t hash_grid(const float* values, int width, int height);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent pool of worker threads with one task deque per worker
+// workers take from the back of their own deque and steal from the front of the others
+class ThreadPool {
+    public:
+        // thread_count is the number of extra worker threads, 0 picks one less than the hardware threads
+        explicit ThreadPool(int thread_count = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // runs every task and returns once all of them have finished, the calling thread helps out
+        // only one batch runs at a time, concurrent callers are serialized
+        void run(std::vector<std::function<void()>>& tasks);
+
+        // number of threads working on a batch, including the caller
+        const int get_concurrency() const { return static_cast<int>(queues.size()); }
+
+    private:
+        struct TaskQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+    private:
+        bool find_task(int index, std::function<void()>& task);
+        void finish_task();
+        void worker_loop(int index);
+
+    private:
+        std::vector<std::unique_ptr<TaskQueue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex run_mutex;
+        std::mutex sleep_mutex;
+        std::condition_variable work_available, batch_done;
+        std::atomic<int> queued, pending;
+        bool stopping;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <limits>
+
+#include <async_influence_updater.hpp>
+#include <parallel_update.hpp>
+
+AsyncInfluenceUpdater::ReadGuard::ReadGuard(ReadGuard&& other) noexcept :
+    slot(other.slot),
+    snapshot(other.snapshot) {
+    other.slot = nullptr;
+    other.snapshot = nullptr;
+}
+
+AsyncInfluenceUpdater::ReadGuard::~ReadGuard() {
+    if (slot == nullptr) {
+        return;
+    }
+
+    // the last guard takes the epoch along, release so the worker sees the reads done before reusing the snapshot
+    std::uint64_t reads = slot->active_reads.load(std::memory_order_relaxed);
+    std::uint64_t next;
+    do {
+        next = reads >> ReaderSlot::READS_SHIFT == 1 ? 0 : reads - ReaderSlot::ONE_READ;
+    } while (!slot->active_reads.compare_exchange_weak(reads, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+AsyncInfluenceUpdater::AsyncInfluenceUpdater(std::vector<std::shared_ptr<InfluenceMap>> maps, ThreadPool* pool) :
+    maps(maps),
+    pool(pool),
+    current(nullptr),
+    reclaim_epoch(1),
+    published_epoch(0),
+    snapshot_count(0),
+    requested_steps(0),
+    busy(false),
+    stopping(false),
+    steps_taken(0) {
+    // nothing else runs yet, so the first snapshot can be published from here
+    publish();
+    worker = std::thread(&AsyncInfluenceUpdater::worker_loop, this);
+}
+
+AsyncInfluenceUpdater::~AsyncInfluenceUpdater() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    worker.join();
+}
+
+void AsyncInfluenceUpdater::request_steps(int count) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requested_steps += count;
+    }
+    work_available.notify_one();
+}
+
+void AsyncInfluenceUpdater::post(std::function<void()> command) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+    }
+    work_available.notify_one();
+}
+
+void AsyncInfluenceUpdater::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return !busy && requested_steps == 0 && commands.empty(); });
+}
+
+int AsyncInfluenceUpdater::register_reader() {
+    for (int i = 0; i < MAX_READERS; ++i) {
+        bool expected = false;
+        if (readers[i].claimed.compare_exchange_strong(expected, true)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void AsyncInfluenceUpdater::unregister_reader(int reader) {
+    readers[reader].active_reads.store(0, std::memory_order_release);
+    readers[reader].claimed.store(false, std::memory_order_release);
+}
+
+AsyncInfluenceUpdater::ReadGuard AsyncInfluenceUpdater::read(int reader) {
+    ReaderSlot& slot = readers[reader];
+
+    // the announcement has to be visible before the pointer is loaded, both are sequentially consistent
+    // (which includes acquire) so a worker that swapped the pointer afterwards is guaranteed to see it
+    // later reads keep the first announcement, the snapshots they load are retired no earlier than it
+    std::uint64_t reads = slot.active_reads.load();
+    std::uint64_t next;
+    do {
+        next = reads == 0 ? ReaderSlot::ONE_READ | reclaim_epoch.load() : reads + ReaderSlot::ONE_READ;
+    } while (!slot.active_reads.compare_exchange_weak(reads, next));
+    return ReadGuard(&slot, current.load());
+}
+
+void AsyncInfluenceUpdater::worker_loop() {
+    while (true) {
+        std::vector<std::function<void()>> pending_commands;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this]() { return stopping || requested_steps > 0 || !commands.empty(); });
+            if (stopping) {
+                return;
+            }
+
+            pending_commands.swap(commands);
+            bool run_step = requested_steps > 0;
+            if (run_step) {
+                --requested_steps;
+            }
+            busy = true;
+            lock.unlock();
+
+            for (auto& command : pending_commands) {
+                command();
+            }
+            if (run_step) {
+                step();
+            }
+
+            lock.lock();
+            busy = false;
+        }
+        idle.notify_all();
+    }
+}
+
+void AsyncInfluenceUpdater::step() {
+    if (pool != nullptr) {
+        recalculate_parallel(*pool, maps);
+    }
+    else {
+        for (auto& inf : maps) {
+            inf->recalculate();
+        }
+    }
+
+    ++steps_taken;
+    publish();
+    reclaim();
+}
+
+void AsyncInfluenceUpdater::publish() {
+    InfluenceSnapshot* snapshot = acquire_snapshot();
+    snapshot->epoch = steps_taken;
+    snapshot->layers.resize(maps.size());
+    for (std::size_t i = 0; i < maps.size(); ++i) {
+        snapshot->layers[i] = maps[i]->get_influence_map();
+    }
+
+    // readers that announced an epoch up to the current one may still hold the old snapshot
+    InfluenceSnapshot* previous = current.exchange(snapshot);
+    if (previous != nullptr) {
+        retired.push_back({previous, reclaim_epoch.fetch_add(1)});
+    }
+    published_epoch.store(steps_taken, std::memory_order_release);
+}
+
+void AsyncInfluenceUpdater::reclaim() {
+    std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+    for (const ReaderSlot& reader : readers) {
+        std::uint64_t epoch = reader.active_reads.load() & ReaderSlot::EPOCH_MASK;
+        if (epoch != 0) {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+
+    // a snapshot retired at epoch e can only be held by reads that announced e or earlier
+    for (auto itr = retired.begin(); itr != retired.end();) {
+        if (itr->epoch < oldest) {
+            free_snapshots.push_back(itr->snapshot);
+            itr = retired.erase(itr);
+        }
+        else {
+            ++itr;
+        }
+    }
+}
+
+InfluenceSnapshot* AsyncInfluenceUpdater::acquire_snapshot() {
+    if (!free_snapshots.empty()) {
+        InfluenceSnapshot* snapshot = free_snapshots.back();
+        free_snapshots.pop_back();
+        return snapshot;
+    }
+
+    snapshots.push_back(std::make_unique<InfluenceSnapshot>());
+    snapshot_count.store(static_cast<int>(snapshots.size()), std::memory_order_relaxed);
+    return snapshots.back().get();
+}
@@ -0,0 +1,1498 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <async_influence_updater.hpp>
+#include <collision_map.hpp>
+#include <compact_influence_map.hpp>
+#include <composite_map.hpp>
+#include <hierarchical_influence_map.hpp>
+#include <influence_file.hpp>
+#include <influence_layers.hpp>
+#include <influence_map.hpp>
+#include <influence_query.hpp>
+#include <lockstep_scheduler.hpp>
+#include <parallel_update.hpp>
+#include <profiler.hpp>
+#include <propagation_kernel.hpp>
+#include <sparse_influence_map.hpp>
+#include <state_hash.hpp>
+
+// times InfluenceMap::recalculate() over a matrix of grid sizes, source counts and wall densities
+//
+// usage: influence_bench [max_size] [min_tiles] [threads]
+//   max_size   largest grid edge to run, sizes double from 64 (default 4096)
+//   min_tiles  minimum number of tiles to process per configuration (default 2^26)
+//   threads    worker threads for the batched parallel run, 0 uses the hardware count (default 0)
+
+struct BenchConfig {
+    int size;
+    int sources;
+    float wall_density;
+};
+
+struct BenchResult {
+    int iterations;
+    double ns_per_tile;
+    double tiles_per_sec;
+};
+
+static std::shared_ptr<CollisionMap> make_collision_map(int size, float wall_density, std::mt19937& rng) {
+    auto collision_map = std::make_shared<CollisionMap>(size, size, 16);
+    std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            if (chance(rng) < wall_density) {
+                collision_map->set_blocked(x, y, true);
+            }
+        }
+    }
+
+    return collision_map;
+}
+
+// terrain classes used by the benchmarks, with the costs set by set_bench_terrain_costs
+enum BenchTerrain : std::uint8_t {
+    OPEN,
+    FOREST,
+    WATER,
+    ROAD
+};
+
+// scatters rectangles of forest, water and road over the map
+static void add_terrain(CollisionMap& collision_map, int patch_count, std::mt19937& rng) {
+    std::uniform_int_distribution<int> coord(0, collision_map.get_width() - 1);
+    std::uniform_int_distribution<int> extent(2, 24);
+    std::uniform_int_distribution<int> terrain_class(FOREST, ROAD);
+    for (int i = 0; i < patch_count; ++i) {
+        collision_map.set_terrain_rect(coord(rng), coord(rng), extent(rng), extent(rng), static_cast<std::uint8_t>(terrain_class(rng)));
+    }
+}
+
+static void set_bench_terrain_costs(InfluenceMap& inf) {
+    inf.set_terrain_cost(FOREST, 2.5f);
+    inf.set_terrain_cost(WATER, 6.0f);
+    inf.set_terrain_cost(ROAD, 0.5f);
+}
+
+// runs the same odd-sized map through every supported kernel and compares against the scalar path
+static bool verify_simd_levels() {
+    const int steps = 64;
+    const float tolerance = 1e-5f;
+    SimdLevel best = get_simd_level();
+    std::vector<std::vector<float>> results;
+    bool ok = true;
+
+    for (int level = 0; level <= static_cast<int>(best); ++level) {
+        set_simd_level(static_cast<SimdLevel>(level));
+
+        // every stencil and combine rule with and without terrain, each one is a separate kernel instantiation
+        std::vector<float> combined;
+        for (int terrain = 0; terrain < 2; ++terrain) {
+            for (int stencil = 0; stencil < 3; ++stencil) {
+                for (int rule = 0; rule < 3; ++rule) {
+                    std::mt19937 rng(1219);
+                    auto collision_map = make_collision_map(131, 0.2f, rng);
+                    if (terrain) {
+                        add_terrain(*collision_map, 48, rng);
+                    }
+                    InfluenceMap positive("positive", collision_map, 5.0f, 0.3f, 0.4f);
+                    InfluenceMap negative("negative", collision_map, -3.0f, 0.2f, 0.6f);
+                    for (InfluenceMap* inf : {&positive, &negative}) {
+                        inf->set_stencil(static_cast<Stencil>(stencil), static_cast<CombineRule>(rule));
+                        inf->set_stencil_weights({0.5f, 1.0f, 0.25f, 1.0f, 0.0f, 0.8f, 0.3f, 1.0f, 0.6f});
+                        set_bench_terrain_costs(*inf);
+                    }
+
+                    std::uniform_int_distribution<int> coord(0, 130);
+                    for (int i = 0; i < 16; ++i) {
+                        positive.add_influence(coord(rng), coord(rng));
+                        negative.add_influence(coord(rng), coord(rng));
+                    }
+
+                    for (int i = 0; i < steps; ++i) {
+                        positive.recalculate();
+                        negative.recalculate();
+                    }
+
+                    const auto& pos = positive.get_influence_map();
+                    const auto& neg = negative.get_influence_map();
+                    combined.insert(combined.end(), pos.begin(), pos.end());
+                    combined.insert(combined.end(), neg.begin(), neg.end());
+                }
+            }
+        }
+        results.push_back(std::move(combined));
+
+        float max_diff = 0.0f;
+        for (std::size_t i = 0; i < results[0].size(); ++i) {
+            max_diff = std::max(max_diff, std::abs(results.back()[i] - results[0][i]));
+        }
+
+        bool level_ok = max_diff <= tolerance;
+        ok = ok && level_ok;
+        std::printf("kernel %-8s max diff vs scalar %g %s\n", get_simd_level_name(static_cast<SimdLevel>(level)),
+                max_diff, level_ok ? "ok" : "MISMATCH");
+    }
+
+    set_simd_level(best);
+    return ok;
+}
+
+// weights above the bound are clamped, so a lone source never grows past its own strength however long it runs
+static bool verify_stencil_weights() {
+    const int size = 64;
+    bool ok = true;
+
+    for (int terrain = 0; terrain < 2; ++terrain) {
+        auto collision_map = std::make_shared<CollisionMap>(size, size, 16);
+        if (terrain) {
+            collision_map->set_terrain_rect(0, 0, size, size, ROAD);
+        }
+        InfluenceMap inf("weights", collision_map, 5.0f, 0.3f, 0.4f);
+        inf.set_stencil(Stencil::WEIGHTED, CombineRule::MAX_ABS);
+        inf.set_stencil_weights({4.0f, 4.0f, 4.0f, 4.0f, 4.0f, 4.0f, 4.0f, 4.0f, 4.0f});
+        set_bench_terrain_costs(inf);
+        inf.add_influence(size / 2, size / 2);
+
+        for (int i = 0; i < 4 * size; ++i) {
+            inf.recalculate();
+        }
+
+        // written so a NaN fails the check as well
+        float max_value = 0.0f;
+        bool bounded = true;
+        for (float value : inf.get_influence_map()) {
+            bounded = bounded && std::abs(value) <= 5.0f + 1e-4f;
+            max_value = std::max(max_value, std::abs(value));
+        }
+        ok = ok && bounded;
+        std::printf("weights of 4 %-10s max %g %s\n", terrain ? "on road" : "on open", max_value, bounded ? "ok" : "UNBOUNDED");
+    }
+
+    return ok;
+}
+
+static BenchResult run_config(const BenchConfig& config, long long min_tiles) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(config.size, config.wall_density, rng);
+    InfluenceMap inf("bench", collision_map, 5.0f, 0.5f, 0.3f);
+
+    std::uniform_int_distribution<int> coord(0, config.size - 1);
+    for (int i = 0; i < config.sources; ++i) {
+        inf.add_influence(coord(rng), coord(rng));
+    }
+
+    long long tiles = static_cast<long long>(config.size) * config.size;
+    int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+
+    // warm up caches and let the influence spread a bit before timing
+    inf.recalculate();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        inf.recalculate();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    double total_tiles = static_cast<double>(tiles) * iterations;
+
+    return {iterations, ns / total_tiles, total_tiles / (ns * 1e-9)};
+}
+
+// recalculates a batch of same-sized maps one after another and then on the pool
+static bool run_batch(int size, int map_count, long long min_tiles, int threads) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    std::vector<std::shared_ptr<InfluenceMap>> serial_maps, parallel_maps;
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int i = 0; i < map_count; ++i) {
+        auto serial = std::make_shared<InfluenceMap>("serial", collision_map, 5.0f, 0.5f, 0.3f);
+        auto parallel = std::make_shared<InfluenceMap>("parallel", collision_map, 5.0f, 0.5f, 0.3f);
+        for (int s = 0; s < 64; ++s) {
+            int x = coord(rng), y = coord(rng);
+            serial->add_influence(x, y);
+            parallel->add_influence(x, y);
+        }
+        serial_maps.push_back(serial);
+        parallel_maps.push_back(parallel);
+    }
+
+    ThreadPool pool(threads);
+    long long tiles = static_cast<long long>(size) * size * map_count;
+    int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto& inf : serial_maps) {
+            inf->recalculate();
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        recalculate_parallel(pool, parallel_maps);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    bool identical = true;
+    for (int i = 0; i < map_count; ++i) {
+        identical = identical && serial_maps[i]->get_influence_map() == parallel_maps[i]->get_influence_map();
+    }
+
+    double total_tiles = static_cast<double>(tiles) * iterations;
+    double serial_ns = std::chrono::duration<double, std::nano>(middle - start).count();
+    double parallel_ns = std::chrono::duration<double, std::nano>(end - middle).count();
+
+    std::printf("\nbatch of %d maps at %dx%d, %d threads\n", map_count, size, size, pool.get_concurrency());
+    std::printf("%-12s %10.3f ns/tile %14.4g tiles/sec\n", "serial", serial_ns / total_tiles, total_tiles / (serial_ns * 1e-9));
+    std::printf("%-12s %10.3f ns/tile %14.4g tiles/sec %s\n", "parallel", parallel_ns / total_tiles, total_tiles / (parallel_ns * 1e-9),
+            identical ? "identical" : "MISMATCH");
+
+    return identical;
+}
+
+// a few sources walk around a settled map, comparing incremental updates against full sweeps
+static bool run_incremental(int size, long long min_tiles) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    InfluenceMap full("full", collision_map, 5.0f, 0.5f, 0.3f);
+    InfluenceMap sparse("incremental", collision_map, 5.0f, 0.5f, 0.3f);
+    sparse.set_incremental(true);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    std::vector<std::pair<int, int>> units;
+    std::vector<SourceHandle> handles;
+    for (int i = 0; i < 4; ++i) {
+        units.emplace_back(coord(rng), coord(rng));
+        full.add_influence(units.back().first, units.back().second);
+        handles.push_back(sparse.add_influence(units.back().first, units.back().second));
+    }
+
+    // let both settle before timing
+    for (int i = 0; i < 200; ++i) {
+        full.recalculate();
+        sparse.recalculate();
+    }
+
+    long long tiles = static_cast<long long>(size) * size;
+    int iterations = static_cast<int>(std::max(20LL, min_tiles / tiles));
+    double full_ns = 0.0, sparse_ns = 0.0;
+    long long active_blocks = 0;
+
+    for (int i = 0; i < iterations; ++i) {
+        // every few steps one unit takes a step to the right, the incremental map moves its source instead of
+        // replacing it
+        if (i % 4 == 0) {
+            std::size_t unit_index = (i / 4) % units.size();
+            auto& unit = units[unit_index];
+            full.remove_influence(unit.first, unit.second);
+            unit.first = (unit.first + 1) % size;
+            full.add_influence(unit.first, unit.second);
+            sparse.move_source(handles[unit_index], unit.first, unit.second);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        full.recalculate();
+        auto middle = std::chrono::steady_clock::now();
+        sparse.recalculate();
+        auto end = std::chrono::steady_clock::now();
+
+        full_ns += std::chrono::duration<double, std::nano>(middle - start).count();
+        sparse_ns += std::chrono::duration<double, std::nano>(end - middle).count();
+        active_blocks += sparse.get_active_block_count();
+    }
+
+    float max_diff = 0.0f;
+    for (std::size_t i = 0; i < full.get_influence_map().size(); ++i) {
+        max_diff = std::max(max_diff, std::abs(full.get_influence_map()[i] - sparse.get_influence_map()[i]));
+    }
+
+    // moved sources stay reachable through their new tile
+    for (const auto& unit : units) {
+        sparse.remove_influence(unit.first, unit.second);
+    }
+    bool sources_removed = sparse.get_sources().get_sources().empty();
+
+    int blocks = collision_map->get_blocks_x() * collision_map->get_blocks_y();
+    std::printf("\nincremental, 4 moving sources at %dx%d\n", size, size);
+    std::printf("%-12s %10.3f ms/step\n", "full", full_ns / iterations * 1e-6);
+    std::printf("%-12s %10.3f ms/step, %.1f of %d blocks active, max diff %g\n", "incremental", sparse_ns / iterations * 1e-6,
+            static_cast<double>(active_blocks) / iterations, blocks, max_diff);
+    if (!sources_removed) {
+        std::printf("moved sources were not found at their new tiles\n");
+    }
+
+    return max_diff < 0.01f && sources_removed;
+}
+
+// thousands of units moving every tick through the batch api
+static void run_source_churn(int size, int unit_count, int ticks) {
+    std::mt19937 rng(1219);
+    auto collision_map = std::make_shared<CollisionMap>(size, size, 16);
+    InfluenceMap inf("units", collision_map, 5.0f, 0.5f, 0.3f);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    std::vector<SourceMove> moves;
+    for (int i = 0; i < unit_count; ++i) {
+        int x = coord(rng), y = coord(rng);
+        moves.push_back({inf.add_source(x, y, 5.0f), x, y});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; ++t) {
+        for (auto& move : moves) {
+            move.tile_x = (move.tile_x + 1) % size;
+        }
+        inf.move_sources(moves);
+
+        // some units die and respawn every tick
+        for (int i = 0; i < unit_count / 100; ++i) {
+            auto& move = moves[coord(rng) % unit_count];
+            inf.remove_source(move.handle);
+            move.handle = inf.add_source(move.tile_x, move.tile_y, 5.0f);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::printf("\nsource churn, %d units on %dx%d\n", unit_count, size, size);
+    std::printf("%-12s %10.3f us/tick %10.2f ns/unit\n", "move+churn", ns / ticks * 1e-3, ns / ticks / unit_count);
+}
+
+// compares the one-shot solver against running recalculate() until it stops changing
+static bool run_steady_state(int size, Stencil stencil, bool terrain) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.2f, rng);
+    if (terrain) {
+        add_terrain(*collision_map, size / 4, rng);
+    }
+    InfluenceMap iterated("iterated", collision_map, 5.0f, 0.4f, 0.5f);
+    InfluenceMap solved("solved", collision_map, 5.0f, 0.4f, 0.5f);
+    iterated.set_stencil(stencil);
+    solved.set_stencil(stencil);
+    set_bench_terrain_costs(iterated);
+    set_bench_terrain_costs(solved);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    std::uniform_real_distribution<float> strength(-8.0f, 8.0f);
+    std::vector<int> source_tiles;
+    for (int i = 0; i < 24; ++i) {
+        int x = coord(rng), y = coord(rng);
+        float s = strength(rng);
+        iterated.add_influence(x, y, s);
+        solved.add_influence(x, y, s);
+        source_tiles.push_back(size * y + x);
+    }
+
+    int steps = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> previous;
+    do {
+        previous = iterated.get_influence_map();
+        iterated.recalculate();
+        ++steps;
+    } while (previous != iterated.get_influence_map() && steps < 100000);
+    auto middle = std::chrono::steady_clock::now();
+    solved.solve_steady_state();
+    auto end = std::chrono::steady_clock::now();
+
+    // source tiles differ on purpose, the solver stores the full strength there
+    float max_diff = 0.0f;
+    for (std::size_t i = 0; i < previous.size(); ++i) {
+        if (std::find(source_tiles.begin(), source_tiles.end(), static_cast<int>(i)) == source_tiles.end()) {
+            max_diff = std::max(max_diff, std::abs(iterated.get_influence_map()[i] - solved.get_influence_map()[i]));
+        }
+    }
+
+    std::printf("\nsteady state, 24 mixed sources at %dx%d, %s neighbors%s\n", size, size, stencil == Stencil::FOUR ? "4" : "8",
+            terrain ? ", terrain" : "");
+    std::printf("%-12s %10.3f ms (%d steps)\n", "iterated", std::chrono::duration<double, std::milli>(middle - start).count(), steps);
+    std::printf("%-12s %10.3f ms, max diff %g\n", "solved", std::chrono::duration<double, std::milli>(end - middle).count(), max_diff);
+
+    return max_diff < 1e-4f;
+}
+
+// a large world with a coarse level and fine patches around a few sources, checked against full resolution
+static void run_hierarchical(int size, int factor, int steps) {
+    std::mt19937 rng(1219);
+    auto collision_map = std::make_shared<CollisionMap>(size, size, 16);
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    std::uniform_int_distribution<int> wall_length(4, 64);
+    for (int i = 0; i < size * size / 2048; ++i) {
+        bool horizontal = coord(rng) % 2 == 0;
+        int length = wall_length(rng);
+        collision_map->set_blocked_rect(coord(rng), coord(rng), horizontal ? length : 1, horizontal ? 1 : length, true);
+    }
+
+    HierarchicalInfluenceMap hierarchy("hierarchy", collision_map, factor, 5.0f, 0.05f, 0.5f);
+    InfluenceMap full("full", collision_map, 5.0f, 0.05f, 0.5f);
+    std::vector<SourceMove> moves, full_moves;
+    for (int i = 0; i < 4; ++i) {
+        int x = coord(rng), y = coord(rng);
+        moves.push_back({hierarchy.add_source(x, y, 5.0f), x, y});
+        full_moves.push_back({full.add_source(x, y, 5.0f), x, y});
+    }
+
+    double hierarchy_ns = 0.0, full_ns = 0.0;
+    for (int i = 0; i < steps; ++i) {
+        // the sources wander right, across patch borders on the way
+        if (i % 4 == 0) {
+            for (std::size_t m = 0; m < moves.size(); ++m) {
+                moves[m].tile_x = std::min(moves[m].tile_x + 1, size - 1);
+                hierarchy.move_source(moves[m].handle, moves[m].tile_x, moves[m].tile_y);
+                full.move_source(full_moves[m].handle, moves[m].tile_x, moves[m].tile_y);
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        hierarchy.recalculate();
+        auto middle = std::chrono::steady_clock::now();
+        full.recalculate();
+        auto end = std::chrono::steady_clock::now();
+        hierarchy_ns += std::chrono::duration<double, std::nano>(middle - start).count();
+        full_ns += std::chrono::duration<double, std::nano>(end - middle).count();
+    }
+
+    double total_diff = 0.0;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            total_diff += std::abs(hierarchy.sample(x, y) - full.get_influence_map()[size * y + x]);
+        }
+    }
+
+    int coarse_tiles = hierarchy.get_coarse_map().get_influence_map().size();
+    long long patch_tiles = static_cast<long long>(hierarchy.get_patch_count()) * (hierarchy.get_patch_size() + 2) * (hierarchy.get_patch_size() + 2);
+    std::printf("\nhierarchical 1/%d with %d patches at %dx%d, %d steps\n", factor, hierarchy.get_patch_count(), size, size, steps);
+    std::printf("%-12s %10.3f ms/step %10.2f MB\n", "full", full_ns / steps * 1e-6, size * static_cast<double>(size) * 8 / (1 << 20));
+    std::printf("%-12s %10.3f ms/step %10.2f MB, mean abs diff %g\n", "hierarchical", hierarchy_ns / steps * 1e-6,
+            (coarse_tiles + patch_tiles) * 8.0 / (1 << 20), total_diff / (static_cast<double>(size) * size));
+}
+
+// dozens of mostly empty maps sharing one chunk pool, checked against dense maps
+static void run_sparse(int size, int map_count, int steps) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    auto pool = std::make_shared<ChunkPool>(SparseInfluenceMap::CHUNK_SIZE * SparseInfluenceMap::CHUNK_SIZE);
+    std::vector<std::unique_ptr<SparseInfluenceMap>> sparse_maps;
+    InfluenceMap dense("dense", collision_map, 5.0f, 0.5f, 0.3f);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int m = 0; m < map_count; ++m) {
+        sparse_maps.push_back(std::make_unique<SparseInfluenceMap>("sparse", collision_map, 5.0f, 0.5f, 0.3f, true, pool));
+        for (int i = 0; i < 8; ++i) {
+            int x = coord(rng), y = coord(rng);
+            sparse_maps.back()->add_source(x, y, 5.0f);
+            if (m == 0) {
+                dense.add_influence(x, y, 5.0f);
+            }
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        for (auto& inf : sparse_maps) {
+            inf->recalculate();
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        dense.recalculate();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    float max_diff = 0.0f;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            max_diff = std::max(max_diff, std::abs(sparse_maps[0]->get_influence(x, y) - dense.get_influence_map()[size * y + x]));
+        }
+    }
+
+    double sparse_ms = std::chrono::duration<double, std::milli>(middle - start).count() / steps / map_count;
+    double dense_ms = std::chrono::duration<double, std::milli>(end - middle).count() / steps;
+    std::printf("\nsparse chunks, %d maps with 8 sources at %dx%d\n", map_count, size, size);
+    std::printf("%-12s %10.3f ms/step/map %10.2f MB/map\n", "dense", dense_ms, size * static_cast<double>(size) * 8 / (1 << 20));
+    std::printf("%-12s %10.3f ms/step/map %10.2f MB/map, %zu chunks in use, max diff %g\n", "sparse", sparse_ms,
+            pool->get_reserved_bytes() / static_cast<double>(map_count) / (1 << 20), pool->get_chunks_in_use(), max_diff);
+    std::printf("%-12s %10.2f MB saved over %d dense maps, sparse step %.2fx the dense one\n", "memory",
+            (size * static_cast<double>(size) * 8 * map_count - pool->get_reserved_bytes()) / (1 << 20), map_count, sparse_ms / dense_ms);
+}
+
+// one fused InfluenceLayers pass against separate maps with the same parameters, one per faction
+static bool run_layers(int size, int layer_count, long long min_tiles) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    std::vector<std::shared_ptr<InfluenceMap>> maps;
+    InfluenceLayers layers(collision_map);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int l = 0; l < layer_count; ++l) {
+        float decay = 0.2f + 0.05f * l;
+        float momentum = 0.2f + 0.02f * l;
+        float source_strength = l % 2 == 0 ? 5.0f : -5.0f;
+        maps.push_back(std::make_shared<InfluenceMap>("faction", collision_map, source_strength, decay, momentum));
+        layers.add_layer("faction", source_strength, decay, momentum);
+        for (int s = 0; s < 64; ++s) {
+            int x = coord(rng), y = coord(rng);
+            maps.back()->add_influence(x, y);
+            layers.add_source(l, x, y);
+        }
+    }
+
+    long long tiles = static_cast<long long>(size) * size * layer_count;
+    int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto& inf : maps) {
+            inf->recalculate();
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        layers.recalculate();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    bool identical = true;
+    std::vector<float> layer_values;
+    for (int l = 0; l < layer_count; ++l) {
+        layers.copy_layer(l, layer_values);
+        identical = identical && layer_values == maps[l]->get_influence_map();
+    }
+
+    double total_tiles = static_cast<double>(tiles) * iterations;
+    double separate_ns = std::chrono::duration<double, std::nano>(middle - start).count();
+    double fused_ns = std::chrono::duration<double, std::nano>(end - middle).count();
+
+    std::printf("\n%d layers at %dx%d, stride %d\n", layer_count, size, size, layers.get_stride());
+    std::printf("%-12s %10.3f ns/tile/layer\n", "separate", separate_ns / total_tiles);
+    std::printf("%-12s %10.3f ns/tile/layer %s\n", "fused", fused_ns / total_tiles, identical ? "identical" : "MISMATCH");
+
+    return identical;
+}
+
+// tension and vulnerability through CompositeMap against per tile loops with temporary grids
+static bool run_composite(int size, int steps) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    auto friendly = std::make_shared<InfluenceMap>("friendly", collision_map, 5.0f, 0.3f, 0.3f);
+    auto enemy = std::make_shared<InfluenceMap>("enemy", collision_map, 5.0f, 0.3f, 0.3f);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int s = 0; s < 64; ++s) {
+        friendly->add_influence(coord(rng), coord(rng));
+        enemy->add_influence(coord(rng), coord(rng));
+    }
+    for (int i = 0; i < 50; ++i) {
+        friendly->recalculate();
+        enemy->recalculate();
+    }
+
+    auto f = MapExpr::layer(friendly);
+    auto e = MapExpr::layer(enemy);
+    auto tension = MapExpr::add(f, e);
+    CompositeMap vulnerability(MapExpr::threshold(MapExpr::sub(tension, MapExpr::abs(MapExpr::sub(f, e))), 0.5f));
+
+    // the way it is written by hand today, one temporary grid per intermediate
+    std::vector<float> by_hand;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        const auto& fv = friendly->get_influence_map();
+        const auto& ev = enemy->get_influence_map();
+        std::vector<float> sum(fv.size()), difference(fv.size());
+        for (std::size_t t = 0; t < fv.size(); ++t) {
+            sum[t] = fv[t] + ev[t];
+        }
+        for (std::size_t t = 0; t < fv.size(); ++t) {
+            difference[t] = std::abs(fv[t] - ev[t]);
+        }
+        by_hand.assign(fv.size(), 0.0f);
+        for (std::size_t t = 0; t < fv.size(); ++t) {
+            float value = sum[t] - difference[t];
+            by_hand[t] = value >= 0.5f ? value : 0.0f;
+        }
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        // a generation bump is what a recalculate() in between would do
+        friendly->set_influence(0, 0, friendly->get_influence_map()[0]);
+        vulnerability.evaluate();
+    }
+    auto cached_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        vulnerability.evaluate();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::vector<float> rect;
+    vulnerability.evaluate_rect(size / 4, size / 4, 100, 100, rect);
+    friendly->set_influence(0, 0, friendly->get_influence_map()[0]);
+    std::vector<float> direct_rect;
+    vulnerability.evaluate_rect(size / 4, size / 4, 100, 100, direct_rect);
+
+    bool identical = vulnerability.evaluate() == by_hand && rect == direct_rect;
+
+    // stamping the sources already changes what the layer reads, so the cache must not outlive it
+    friendly->begin_recalculate();
+    bool stale_after_stamp = !vulnerability.is_cached();
+    friendly->recalculate_rows(0, size);
+    friendly->end_recalculate();
+
+    // a layer of another size is refused when the expression is bound
+    auto small_collision = std::make_shared<CollisionMap>(size / 2, size / 2, 16);
+    auto small = std::make_shared<InfluenceMap>("small", small_collision, 5.0f, 0.3f, 0.3f);
+    CompositeMap mismatched(MapExpr::add(f, MapExpr::layer(small)));
+    bool rejected = !mismatched.is_bound() && mismatched.evaluate().empty() && vulnerability.is_bound();
+
+    double tiles = static_cast<double>(size) * size * steps;
+    std::printf("\ncomposite vulnerability at %dx%d\n", size, size);
+    std::printf("%-12s %10.3f ns/tile\n", "by hand", std::chrono::duration<double, std::nano>(middle - start).count() / tiles);
+    std::printf("%-12s %10.3f ns/tile %s\n", "fused", std::chrono::duration<double, std::nano>(cached_start - middle).count() / tiles,
+            identical ? "identical" : "MISMATCH");
+    std::printf("%-12s %10.3f ns/tile\n", "cached", std::chrono::duration<double, std::nano>(end - cached_start).count() / tiles);
+    if (!stale_after_stamp) {
+        std::printf("cache survived stamping the sources\n");
+    }
+    if (!rejected) {
+        std::printf("layers of different sizes were not rejected\n");
+    }
+
+    return identical && stale_after_stamp && rejected;
+}
+
+// batched radius top-k queries against scanning the disc by hand
+static bool run_queries(int size, int query_count, int threads) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    auto inf = std::make_shared<InfluenceMap>("queries", collision_map, 5.0f, 0.3f, 0.3f);
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int s = 0; s < 64; ++s) {
+        inf->add_influence(coord(rng), coord(rng), s % 2 == 0 ? 5.0f : -5.0f);
+    }
+    for (int i = 0; i < 100; ++i) {
+        inf->recalculate();
+    }
+
+    std::uniform_int_distribution<int> radius(4, 48);
+    std::vector<RadiusQuery> queries;
+    for (int i = 0; i < query_count; ++i) {
+        queries.push_back({coord(rng), coord(rng), radius(rng), 4, i % 2 == 1});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<float>> scanned(queries.size());
+    const auto& values = inf->get_influence_map();
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        const RadiusQuery& q = queries[i];
+        for (int y = std::max(q.center_y - q.radius, 0); y <= std::min(q.center_y + q.radius, size - 1); ++y) {
+            for (int x = std::max(q.center_x - q.radius, 0); x <= std::min(q.center_x + q.radius, size - 1); ++x) {
+                if ((x - q.center_x) * (x - q.center_x) + (y - q.center_y) * (y - q.center_y) <= q.radius * q.radius) {
+                    scanned[i].push_back(q.lowest ? -values[size * y + x] : values[size * y + x]);
+                }
+            }
+        }
+        int keep = std::min(q.count, static_cast<int>(scanned[i].size()));
+        std::partial_sort(scanned[i].begin(), scanned[i].begin() + keep, scanned[i].end(), std::greater<float>());
+        scanned[i].resize(keep);
+    }
+    auto middle = std::chrono::steady_clock::now();
+
+    InfluenceQuery query(inf);
+    ThreadPool pool(threads);
+    std::vector<std::vector<QueryResult>> results;
+    query.refresh();
+    auto built = std::chrono::steady_clock::now();
+    query.run_batch(queries, results, &pool);
+    auto end = std::chrono::steady_clock::now();
+
+    bool identical = true;
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        identical = identical && results[i].size() == scanned[i].size();
+        for (std::size_t k = 0; identical && k < results[i].size(); ++k) {
+            const QueryResult& r = results[i][k];
+            identical = (queries[i].lowest ? -r.value : r.value) == scanned[i][k] && values[size * r.tile_y + r.tile_x] == r.value;
+        }
+    }
+
+    double area_check = query.area_sum(0, 0, size, size);
+    double area_scan = 0.0;
+    for (float v : values) {
+        area_scan += v;
+    }
+    identical = identical && std::abs(area_check - area_scan) < 1e-6 * std::max(1.0, std::abs(area_scan));
+
+    // a settled incremental map with one unit walking, the tables follow only the blocks that changed
+    auto sleepy = std::make_shared<InfluenceMap>("sleepy", collision_map, 5.0f, 0.5f, 0.3f);
+    sleepy->set_incremental(true);
+    int unit_x = coord(rng), unit_y = coord(rng);
+    SourceHandle unit = sleepy->add_source(unit_x, unit_y, 5.0f);
+    sleepy->add_source(coord(rng), coord(rng), -5.0f);
+    for (int i = 0; i < 200; ++i) {
+        sleepy->recalculate();
+    }
+
+    InfluenceQuery follower(sleepy);
+    follower.refresh();
+    const int refresh_steps = 50;
+    double incremental_ns = 0.0, rebuild_ns = 0.0;
+    bool refreshed_identical = true;
+    std::vector<std::vector<QueryResult>> followed, rebuilt;
+    for (int i = 0; i < refresh_steps; ++i) {
+        unit_x = (unit_x + 1) % size;
+        sleepy->move_source(unit, unit_x, unit_y);
+        sleepy->recalculate();
+
+        auto refresh_start = std::chrono::steady_clock::now();
+        follower.refresh();
+        auto refresh_middle = std::chrono::steady_clock::now();
+        InfluenceQuery fresh(sleepy);
+        fresh.refresh();
+        auto refresh_end = std::chrono::steady_clock::now();
+        incremental_ns += std::chrono::duration<double, std::nano>(refresh_middle - refresh_start).count();
+        rebuild_ns += std::chrono::duration<double, std::nano>(refresh_end - refresh_middle).count();
+
+        if (i % 10 == 9) {
+            follower.run_batch(queries, followed);
+            fresh.run_batch(queries, rebuilt);
+            for (std::size_t q = 0; q < queries.size(); ++q) {
+                for (std::size_t k = 0; refreshed_identical && k < followed[q].size(); ++k) {
+                    refreshed_identical = followed[q][k].value == rebuilt[q][k].value;
+                }
+            }
+            for (int r = 0; r < 16; ++r) {
+                int x = coord(rng), y = coord(rng);
+                refreshed_identical = refreshed_identical && follower.area_sum(x, y, 40, 40) == fresh.area_sum(x, y, 40, 40);
+            }
+        }
+    }
+
+    std::printf("\n%d radius top-4 queries at %dx%d\n", query_count, size, size);
+    std::printf("%-12s %10.3f us/query\n", "scan", std::chrono::duration<double, std::micro>(middle - start).count() / query_count);
+    std::printf("%-12s %10.3f us/query %s, %.3f ms to build the tables\n", "pyramid",
+            std::chrono::duration<double, std::micro>(end - built).count() / query_count, identical ? "identical" : "MISMATCH",
+            std::chrono::duration<double, std::milli>(built - middle).count());
+    std::printf("%-12s %10.3f ms/refresh, %.3f ms to rebuild, %d of %d blocks active %s\n", "refresh",
+            incremental_ns / refresh_steps * 1e-6, rebuild_ns / refresh_steps * 1e-6, sleepy->get_active_block_count(),
+            collision_map->get_blocks_x() * collision_map->get_blocks_y(), refreshed_identical ? "identical" : "MISMATCH");
+
+    return identical && refreshed_identical;
+}
+
+// steps on the background thread while a reader thread keeps taking snapshots
+// the two maps are identical, so a snapshot mixing two steps would show up as a difference between them
+static bool run_async(int size, int steps) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    std::vector<std::shared_ptr<InfluenceMap>> maps = {
+        std::make_shared<InfluenceMap>("a", collision_map, 5.0f, 0.3f, 0.3f),
+        std::make_shared<InfluenceMap>("b", collision_map, 5.0f, 0.3f, 0.3f),
+    };
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int s = 0; s < 64; ++s) {
+        int x = coord(rng), y = coord(rng);
+        maps[0]->add_influence(x, y);
+        maps[1]->add_influence(x, y);
+    }
+
+    AsyncInfluenceUpdater updater(maps);
+    std::atomic<bool> done(false);
+    std::atomic<bool> consistent(true);
+    std::atomic<long long> reads(0);
+
+    auto read_loop = [&](int slot) {
+        std::uint64_t last_epoch = 0;
+        while (!done.load()) {
+            auto snapshot = updater.read(slot);
+            std::uint64_t epoch = snapshot->epoch;
+            // a nested read on the same slot must not release the outer snapshot when it ends
+            {
+                auto inner = updater.read(slot);
+                if (inner->epoch < epoch) {
+                    consistent = false;
+                }
+            }
+            if (epoch < last_epoch || snapshot->epoch != epoch || snapshot->layers[0] != snapshot->layers[1]) {
+                consistent = false;
+            }
+            last_epoch = epoch;
+            ++reads;
+        }
+    };
+    double request_ns = 0.0;
+    auto request_steps = [&](int count) {
+        for (int i = 0; i < count; ++i) {
+            auto before = std::chrono::steady_clock::now();
+            updater.request_steps(1);
+            // a source moving every tick, applied on the worker between steps
+            int x = coord(rng), y = coord(rng);
+            updater.post([&maps, x, y]() {
+                maps[0]->add_influence(x, y, 1.0f);
+                maps[1]->add_influence(x, y, 1.0f);
+            });
+            request_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+            std::this_thread::yield();
+        }
+    };
+
+    int slot = updater.register_reader();
+    std::thread reader(read_loop, slot);
+    auto start = std::chrono::steady_clock::now();
+    request_steps(steps);
+    updater.wait_idle();
+    auto end = std::chrono::steady_clock::now();
+    done = true;
+    reader.join();
+    int snapshots = updater.get_snapshot_count();
+    double request_us = request_ns / steps * 1e-3;
+
+    // two threads sharing the slot, their guards come and go independently
+    // while their reads keep overlapping the slot holds its first epoch, so more snapshots are allocated
+    const int shared_steps = 50;
+    long long own_reads = reads.exchange(0);
+    done = false;
+    std::thread sharing[] = {std::thread(read_loop, slot), std::thread(read_loop, slot)};
+    request_steps(shared_steps);
+    updater.wait_idle();
+    done = true;
+    for (std::thread& thread : sharing) {
+        thread.join();
+    }
+
+    bool matches = updater.read(slot)->layers[0] == maps[0]->get_influence_map() &&
+        updater.get_published_epoch() == static_cast<std::uint64_t>(steps + shared_steps);
+    updater.unregister_reader(slot);
+
+    bool ok = consistent && matches;
+    std::printf("\nasync updates, 2 maps at %dx%d, %d steps\n", size, size, steps);
+    std::printf("%-12s %10.3f us per tick to request, %.3f ms total, %lld reads, %d snapshots %s\n", "async",
+            request_us, std::chrono::duration<double, std::milli>(end - start).count(), own_reads, snapshots, ok ? "consistent" : "MISMATCH");
+    std::printf("%-12s %d steps, %lld reads from 2 threads on one slot, %d snapshots\n", "shared slot", shared_steps, reads.load(),
+            updater.get_snapshot_count());
+
+    return ok;
+}
+
+// writes collision words and one layer in the version 1 layout, the way files from before terrain look
+static bool write_version_1_file(const std::string& path, CollisionMap& collision_map, InfluenceMap& inf) {
+    auto align = [](std::uint64_t offset) { return (offset + influence_file::SECTION_ALIGNMENT - 1) / influence_file::SECTION_ALIGNMENT * influence_file::SECTION_ALIGNMENT; };
+    std::uint64_t tile_count = static_cast<std::uint64_t>(collision_map.get_width()) * collision_map.get_height();
+    std::vector<influence_file::FileSource> sources;
+    for (const auto& src : inf.get_sources().get_sources()) {
+        sources.push_back({src.x, src.y, src.strength});
+    }
+
+    influence_file::FileHeader header = {};
+    std::memcpy(header.magic, influence_file::MAGIC, sizeof(influence_file::MAGIC));
+    header.version = 1;
+    header.byte_order = influence_file::BYTE_ORDER_MARK;
+    header.width = collision_map.get_width();
+    header.height = collision_map.get_height();
+    header.tile_size = collision_map.get_tile_size();
+    header.words_per_row = collision_map.get_words_per_row();
+    header.layer_count = 1;
+    header.collision_offset = align(influence_file::FILE_HEADER_SIZE_V1 + influence_file::LAYER_HEADER_SIZE_V1);
+
+    influence_file::LayerHeader layer = {};
+    std::strncpy(layer.name, inf.get_name().c_str(), influence_file::NAME_LENGTH - 1);
+    layer.strength = inf.get_strength();
+    layer.decay = inf.get_decay();
+    layer.momentum = inf.get_momentum();
+    layer.collision_enabled = 1;
+    layer.values_offset = align(header.collision_offset + collision_map.get_collision_words().size() * sizeof(std::uint64_t));
+    layer.sources_offset = align(layer.values_offset + tile_count * sizeof(float));
+    layer.source_count = sources.size();
+    header.file_size = layer.sources_offset + sources.size() * sizeof(influence_file::FileSource);
+
+    std::vector<char> bytes(header.file_size, 0);
+    std::memcpy(bytes.data(), &header, influence_file::FILE_HEADER_SIZE_V1);
+    std::memcpy(bytes.data() + influence_file::FILE_HEADER_SIZE_V1, &layer, influence_file::LAYER_HEADER_SIZE_V1);
+    std::memcpy(bytes.data() + header.collision_offset, collision_map.get_collision_words().data(), collision_map.get_collision_words().size() * sizeof(std::uint64_t));
+    std::memcpy(bytes.data() + layer.values_offset, inf.get_influence_map().data(), tile_count * sizeof(float));
+    std::memcpy(bytes.data() + layer.sources_offset, sources.data(), sources.size() * sizeof(influence_file::FileSource));
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// save and reload a collision map with its layers, against rebuilding them tile by tile
+static bool run_file(int size, int layer_count) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    add_terrain(*collision_map, size / 8, rng);
+    std::vector<std::shared_ptr<InfluenceMap>> maps;
+
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int l = 0; l < layer_count; ++l) {
+        maps.push_back(std::make_shared<InfluenceMap>("layer", collision_map, 5.0f, 0.3f, 0.3f));
+        if (l == 0) {
+            set_bench_terrain_costs(*maps.back());
+        }
+        else {
+            maps.back()->set_stencil(Stencil::WEIGHTED, CombineRule::AVERAGE);
+            maps.back()->set_stencil_weights({0.5f, 1.0f, 0.25f, 1.0f, 0.0f, 0.8f, 0.3f, 1.0f, 0.6f});
+        }
+        for (int s = 0; s < 64; ++s) {
+            maps.back()->add_influence(coord(rng), coord(rng));
+        }
+        // two more sources sharing a tile, both have to come back
+        int x = coord(rng), y = coord(rng);
+        maps.back()->add_source(x, y, 2.0f);
+        maps.back()->add_source(x, y, 3.0f);
+        for (int i = 0; i < 20; ++i) {
+            maps.back()->recalculate();
+        }
+    }
+
+    std::string path = (std::filesystem::temp_directory_path() / "influence_bench.map").string();
+    auto start = std::chrono::steady_clock::now();
+    bool ok = save_influence_file(path, *collision_map, maps);
+    auto saved = std::chrono::steady_clock::now();
+
+    auto file = MappedInfluenceFile::open(path);
+    auto mapped = std::chrono::steady_clock::now();
+    ok = ok && file != nullptr;
+
+    std::shared_ptr<CollisionMap> loaded_collision;
+    std::vector<std::shared_ptr<InfluenceMap>> loaded;
+    if (ok) {
+        loaded_collision = file->copy_collision_map();
+        for (int l = 0; l < file->get_layer_count(); ++l) {
+            loaded.push_back(file->copy_influence_map(l, loaded_collision));
+        }
+    }
+    auto built = std::chrono::steady_clock::now();
+
+    // what the demo does today, one tile at a time
+    auto rebuilt_collision = std::make_shared<CollisionMap>(size, size, collision_map->get_tile_size());
+    std::vector<std::shared_ptr<InfluenceMap>> rebuilt;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            rebuilt_collision->set_blocked(x, y, collision_map->is_blocked(x, y));
+        }
+    }
+    for (int l = 0; l < layer_count; ++l) {
+        rebuilt.push_back(std::make_shared<InfluenceMap>("layer", rebuilt_collision, 5.0f, 0.3f, 0.3f));
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                rebuilt.back()->set_influence(x, y, maps[l]->get_influence_map()[size * y + x]);
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    ok = ok && loaded_collision->get_collision_words() == collision_map->get_collision_words() && static_cast<int>(loaded.size()) == layer_count &&
+        loaded_collision->get_terrain_classes() == collision_map->get_terrain_classes();
+    for (int l = 0; ok && l < layer_count; ++l) {
+        for (int c = 0; ok && c < influence_file::TERRAIN_CLASSES; ++c) {
+            ok = loaded[l]->get_terrain_cost(static_cast<std::uint8_t>(c)) == maps[l]->get_terrain_cost(static_cast<std::uint8_t>(c));
+        }
+        ok = ok && loaded[l]->get_stencil() == maps[l]->get_stencil() && loaded[l]->get_combine_rule() == maps[l]->get_combine_rule() &&
+            loaded[l]->get_stencil_weights() == maps[l]->get_stencil_weights();
+        const auto& saved_sources = maps[l]->get_sources().get_sources();
+        const auto& loaded_sources = loaded[l]->get_sources().get_sources();
+        ok = ok && loaded[l]->get_influence_map() == maps[l]->get_influence_map() && loaded_sources.size() == saved_sources.size();
+        for (std::size_t i = 0; ok && i < saved_sources.size(); ++i) {
+            ok = loaded_sources[i].x == saved_sources[i].x && loaded_sources[i].y == saved_sources[i].y &&
+                loaded_sources[i].strength == saved_sources[i].strength;
+        }
+    }
+    file.reset();
+
+    // a tile size of zero is refused when the file is opened
+    if (ok) {
+        std::FILE* patched = std::fopen(path.c_str(), "r+b");
+        std::int32_t zero = 0;
+        ok = patched != nullptr && std::fseek(patched, offsetof(influence_file::FileHeader, tile_size), SEEK_SET) == 0 &&
+            std::fwrite(&zero, sizeof(zero), 1, patched) == 1;
+        if (patched != nullptr) {
+            std::fclose(patched);
+        }
+        ok = ok && MappedInfluenceFile::open(path) == nullptr;
+    }
+
+    // files from before terrain still load, with no terrain and every class at cost 1.0
+    bool version_1 = write_version_1_file(path, *collision_map, *maps[0]);
+    auto old_file = version_1 ? MappedInfluenceFile::open(path) : nullptr;
+    version_1 = old_file != nullptr && old_file->get_version() == 1;
+    if (version_1) {
+        auto old_collision = old_file->copy_collision_map();
+        auto old_map = old_file->copy_influence_map(0, old_collision);
+        version_1 = !old_collision->has_terrain() && old_collision->get_collision_words() == collision_map->get_collision_words() &&
+            old_map->get_influence_map() == maps[0]->get_influence_map() && old_map->get_terrain_cost(WATER) == 1.0f &&
+            old_map->get_sources().size() == maps[0]->get_sources().size();
+    }
+    old_file.reset();
+    std::filesystem::remove(path);
+
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    std::printf("\nfile with %d layers at %dx%d\n", layer_count, size, size);
+    std::printf("%-12s %10.3f ms\n", "save", ms(start, saved));
+    std::printf("%-12s %10.3f ms map, %.3f ms to build live maps %s\n", "load", ms(saved, mapped), ms(mapped, built), ok ? "identical" : "MISMATCH");
+    std::printf("%-12s %10.3f ms\n", "rebuild", ms(built, end));
+    std::printf("%-12s %s\n", "version 1", version_1 ? "loads" : "FAILED");
+
+    return ok && version_1;
+}
+
+// cost of every stencil and combine rule against the default kernel
+static void run_stencils(int size, long long min_tiles) {
+    const char* stencil_names[] = {"4", "8", "3x3"};
+    const char* rule_names[] = {"max-abs", "average", "signed-max"};
+
+    std::printf("\nstencils at %dx%d\n", size, size);
+    for (int stencil = 0; stencil < 3; ++stencil) {
+        for (int rule = 0; rule < 3; ++rule) {
+            std::mt19937 rng(1219);
+            auto collision_map = make_collision_map(size, 0.1f, rng);
+            InfluenceMap inf("stencil", collision_map, 5.0f, 0.3f, 0.3f);
+            inf.set_stencil(static_cast<Stencil>(stencil), static_cast<CombineRule>(rule));
+
+            std::uniform_int_distribution<int> coord(0, size - 1);
+            for (int s = 0; s < 64; ++s) {
+                inf.add_influence(coord(rng), coord(rng), s % 2 == 0 ? 5.0f : -5.0f);
+            }
+
+            long long tiles = static_cast<long long>(size) * size;
+            int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                inf.recalculate();
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            char name[32];
+            std::snprintf(name, sizeof(name), "%s %s", stencil_names[stencil], rule_names[rule]);
+            std::printf("%-16s %10.3f ns/tile\n", name, ns / (static_cast<double>(tiles) * iterations));
+        }
+    }
+}
+
+// cost of the terrain lookup against the plain kernel, and the memory of the class layer against a float grid
+static void run_terrain(int size, long long min_tiles) {
+    std::printf("\nterrain at %dx%d\n", size, size);
+    for (bool terrain : {false, true}) {
+        std::mt19937 rng(1219);
+        auto collision_map = make_collision_map(size, 0.1f, rng);
+        if (terrain) {
+            add_terrain(*collision_map, size, rng);
+        }
+        InfluenceMap inf("terrain", collision_map, 5.0f, 0.3f, 0.3f);
+        set_bench_terrain_costs(inf);
+
+        std::uniform_int_distribution<int> coord(0, size - 1);
+        for (int s = 0; s < 64; ++s) {
+            inf.add_influence(coord(rng), coord(rng), s % 2 == 0 ? 5.0f : -5.0f);
+        }
+
+        long long tiles = static_cast<long long>(size) * size;
+        int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            inf.recalculate();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        double layer_mb = terrain ? tiles / static_cast<double>(1 << 20) : 0.0;
+        std::printf("%-12s %10.3f ns/tile %10.2f MB layer (%.2f MB as floats)\n", terrain ? "terrain" : "plain",
+                ns / (static_cast<double>(tiles) * iterations), layer_mb, layer_mb * 4);
+    }
+}
+
+// fixed-point maps: identical on every kernel, within get_error_bound() of the float map, and timed against it
+static bool run_compact(int size, int steps, long long min_tiles) {
+    SimdLevel best = get_simd_level();
+    std::vector<std::vector<std::int16_t>> level_values;
+    for (int level = 0; level <= static_cast<int>(best); ++level) {
+        set_simd_level(static_cast<SimdLevel>(level));
+        std::mt19937 rng(1219);
+        auto collision_map = make_collision_map(131, 0.2f, rng);
+        CompactInfluenceMap compact("compact", collision_map, 5.0f, 0.3f, 0.4f);
+        std::uniform_int_distribution<int> coord(0, 130);
+        for (int i = 0; i < 16; ++i) {
+            compact.add_source(coord(rng), coord(rng), i % 2 == 0 ? 5.0f : -4.0f);
+        }
+        for (int i = 0; i < 64; ++i) {
+            compact.recalculate();
+        }
+        level_values.push_back(compact.get_values());
+    }
+    set_simd_level(best);
+    bool levels_ok = std::all_of(level_values.begin(), level_values.end(), [&](const auto& v) { return v == level_values[0]; });
+
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    InfluenceMap full("float", collision_map, 5.0f, 0.3f, 0.3f);
+    CompactInfluenceMap compact("compact", collision_map, 5.0f, 0.3f, 0.3f);
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    // one sign, see the header about the bound where opposite fields meet
+    std::uniform_real_distribution<float> strength(0.5f, 5.0f);
+    for (int i = 0; i < 64; ++i) {
+        int x = coord(rng), y = coord(rng);
+        float s = strength(rng);
+        full.add_source(x, y, s);
+        compact.add_source(x, y, s);
+    }
+
+    // timed first, long runs leave denormal tails in the float map that slow it down for reasons unrelated to bandwidth
+    long long tiles = static_cast<long long>(size) * size;
+    int iterations = static_cast<int>(std::max(3LL, min_tiles / tiles));
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        full.recalculate();
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        compact.recalculate();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (int i = iterations; i < steps; ++i) {
+        full.recalculate();
+        compact.recalculate();
+    }
+
+    std::vector<float> widened;
+    compact.copy_influence(widened);
+    float max_diff = 0.0f;
+    for (std::size_t i = 0; i < widened.size(); ++i) {
+        max_diff = std::max(max_diff, std::abs(widened[i] - full.get_influence_map()[i]));
+    }
+    // a little slack for the float rounding of the float map itself
+    bool bound_ok = max_diff <= compact.get_error_bound() * 1.001f + 1e-6f;
+
+    double total_tiles = static_cast<double>(tiles) * iterations;
+    std::printf("\nfixed-point storage at %dx%d, kernels %s\n", size, size, levels_ok ? "identical" : "MISMATCH");
+    std::printf("%-12s %10.3f ns/tile %10.2f MB\n", "float", std::chrono::duration<double, std::nano>(middle - start).count() / total_tiles,
+            tiles * 8.0 / (1 << 20));
+    std::printf("%-12s %10.3f ns/tile %10.2f MB, max diff %g (bound %g, quantum %g) %s\n", "int16",
+            std::chrono::duration<double, std::nano>(end - middle).count() / total_tiles, tiles * 4.0 / (1 << 20),
+            max_diff, compact.get_error_bound(), compact.get_scale(), bound_ok ? "ok" : "OUT OF BOUND");
+
+    return levels_ok && bound_ok;
+}
+
+// counters and trace of a plain and an incremental map stepped together, the ns/tile line compared between a
+// build with and one without INFLUENCE_MAPS_PROFILING shows what the instrumentation costs
+static bool run_profile(int size, int steps, int threads) {
+    std::mt19937 rng(1219);
+    auto collision_map = make_collision_map(size, 0.1f, rng);
+    auto plain = std::make_shared<InfluenceMap>("plain", collision_map, 5.0f, 0.3f, 0.3f);
+    auto incremental = std::make_shared<InfluenceMap>("incremental", collision_map, 5.0f, 0.3f, 0.3f);
+    incremental->set_incremental(true);
+    std::vector<std::shared_ptr<InfluenceMap>> maps = {plain, incremental};
+
+    const int sources = 16;
+    std::uniform_int_distribution<int> coord(0, size - 1);
+    for (int i = 0; i < sources; ++i) {
+        int x = coord(rng), y = coord(rng);
+        plain->add_source(x, y, 5.0f);
+        incremental->add_source(x, y, 5.0f);
+    }
+
+    ThreadPool pool(threads);
+    InfluenceQuery query(plain);
+    std::vector<RadiusQuery> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back({coord(rng), coord(rng), 16, 4, false});
+    }
+    std::vector<std::vector<QueryResult>> results;
+
+    start_trace();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) {
+        recalculate_parallel(pool, maps);
+    }
+    auto end = std::chrono::steady_clock::now();
+    query.run_batch(queries, results, &pool);
+    query.argmax_radius(size / 2, size / 2, 32);
+    stop_trace();
+
+    std::string path = (std::filesystem::temp_directory_path() / "influence_bench_trace.json").string();
+    bool written = write_chrome_trace(path);
+    std::size_t events = get_trace_events().size();
+    std::size_t written_events = 0;
+    if (std::FILE* file = std::fopen(path.c_str(), "rb")) {
+        std::string text;
+        char chunk[4096];
+        for (std::size_t count; (count = std::fread(chunk, 1, sizeof(chunk), file)) > 0;) {
+            text.append(chunk, count);
+        }
+        std::fclose(file);
+        for (std::size_t at = text.find("\"ph\": \"X\""); at != std::string::npos; at = text.find("\"ph\": \"X\"", at + 1)) {
+            ++written_events;
+        }
+        written = written && text.rfind("{\"displayTimeUnit\"", 0) == 0 && text.find("]}") != std::string::npos;
+    }
+    std::filesystem::remove(path);
+
+    ProfileStats stats = plain->get_profile_stats();
+    ProfileStats sleepy = incremental->get_profile_stats();
+    std::uint64_t tiles = static_cast<std::uint64_t>(size) * size;
+#ifdef INFLUENCE_PROFILING
+    int stamp = static_cast<int>(ProfilePhase::STAMP);
+    int swap = static_cast<int>(ProfilePhase::SWAP);
+    bool counters_ok = stats.steps == static_cast<std::uint64_t>(steps) && stats.tiles_processed == tiles * steps
+        && stats.tiles_changed > 0 && stats.tiles_changed <= stats.tiles_processed && stats.sources_stamped == static_cast<std::uint64_t>(sources) * steps
+        && stats.queries == queries.size() + 1 && stats.phase_calls[stamp] == stats.steps && stats.phase_calls[swap] == stats.steps
+        && sleepy.steps == stats.steps && sleepy.tiles_processed <= stats.tiles_processed && sleepy.queries == 0;
+    bool trace_ok = written && events > 0 && written_events == events;
+#else
+    bool counters_ok = stats.steps == 0 && stats.tiles_processed == 0 && stats.queries == 0 && sleepy.steps == 0;
+    bool trace_ok = written && events == 0 && written_events == 0;
+#endif
+
+    std::printf("\nprofiling %s, 2 maps at %dx%d, %d steps\n",
+#ifdef INFLUENCE_PROFILING
+            "on",
+#else
+            "off",
+#endif
+            size, size, steps);
+    std::printf("%-12s %10.3f ns/tile\n", "step", std::chrono::duration<double, std::nano>(end - start).count() / (2.0 * tiles * steps));
+    for (const auto& map : maps) {
+        ProfileStats map_stats = map->get_profile_stats();
+        double map_steps = static_cast<double>(std::max<std::uint64_t>(map_stats.steps, 1));
+        std::printf("%-12s %8.0f tiles/step %5.1f%% changed", map->get_name().c_str(), map_stats.tiles_processed / map_steps,
+                map_stats.tiles_processed > 0 ? 100.0 * map_stats.tiles_changed / map_stats.tiles_processed : 0.0);
+        for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+            std::printf(" %s %.3f ms", get_profile_phase_name(static_cast<ProfilePhase>(p)),
+                    map_stats.get_phase_milliseconds(static_cast<ProfilePhase>(p)) / map_steps);
+        }
+        std::printf("\n");
+    }
+    std::printf("%-12s %zu events, %s, counters %s\n", "trace", events, trace_ok ? "written" : "BROKEN", counters_ok ? "ok" : "WRONG");
+
+    return counters_ok && trace_ok;
+}
+
+// the same lockstep session at every SIMD level and with several thread counts, driven by frames of uneven
+// length with a stall in the middle, every tick's hashes have to agree between all runs and with a full rehash
+static bool run_lockstep(int size, int ticks) {
+    const double tick_seconds = 0.1;
+    const int sources = 24;
+
+    // frame times in seconds, a 0.75 s stall is caught up 4 ticks per frame
+    std::vector<double> frames;
+    for (int i = 0; frames.size() < 1000; ++i) {
+        frames.push_back(i == 40 ? 0.75 : 0.02 + 0.03 * (i % 5));
+    }
+
+    SimdLevel best = get_simd_level();
+    std::vector<std::vector<std::uint64_t>> runs;
+    bool hashes_ok = true;
+    bool schedule_ok = true;
+    double full_hash_ns = 0.0, incremental_hash_ns = 0.0;
+
+    for (int level = 0; level <= static_cast<int>(best); ++level) {
+        set_simd_level(static_cast<SimdLevel>(level));
+        for (int threads : {0, 1, 3}) {
+            std::mt19937 rng(1219);
+            auto collision_map = make_collision_map(size, 0.1f, rng);
+            add_terrain(*collision_map, 24, rng);
+            std::vector<std::shared_ptr<InfluenceMap>> maps = {
+                std::make_shared<InfluenceMap>("plain", collision_map, 5.0f, 0.3f, 0.3f),
+                std::make_shared<InfluenceMap>("incremental", collision_map, -4.0f, 0.2f, 0.5f),
+                std::make_shared<InfluenceMap>("terrain", collision_map, 6.0f, 0.25f, 0.4f),
+            };
+            maps[1]->set_incremental(true);
+            maps[2]->set_stencil(Stencil::EIGHT);
+            set_bench_terrain_costs(*maps[2]);
+
+            std::vector<std::vector<SourceHandle>> handles(maps.size());
+            for (std::size_t m = 0; m < maps.size(); ++m) {
+                for (int i = 0; i < sources; ++i) {
+                    handles[m].push_back(maps[m]->add_source(0, 0, maps[m]->get_strength()));
+                }
+            }
+
+            // threads 0 steps the maps on the calling thread without a pool
+            std::unique_ptr<ThreadPool> pool = threads > 0 ? std::make_unique<ThreadPool>(threads) : nullptr;
+            LockstepScheduler scheduler(tick_seconds, 4);
+            std::vector<std::uint64_t> tick_hashes;
+
+            auto step = [&](std::uint64_t tick) {
+                // input of the tick, a function of the tick number only like commands in a lockstep game
+                // the incremental map's sources stay where the first tick put them so its quiet blocks fall asleep
+                for (std::size_t m = 0; m < maps.size(); ++m) {
+                    if (m == 1 && tick > 0) {
+                        continue;
+                    }
+                    for (int i = 0; i < sources; ++i) {
+                        std::uint64_t walk = tick * (m + 1) + static_cast<std::uint64_t>(i) * 131;
+                        maps[m]->move_source(handles[m][i], static_cast<int>((walk * 7) % size), static_cast<int>((walk * 3 + i * 17) % size));
+                    }
+                }
+
+                if (pool != nullptr) {
+                    recalculate_parallel(*pool, maps);
+                }
+                else {
+                    for (const auto& map : maps) {
+                        map->recalculate();
+                    }
+                }
+
+                // timed on the incremental map, the others rewrite every block each tick
+                std::uint64_t combined = 0;
+                for (const auto& map : maps) {
+                    auto start = std::chrono::steady_clock::now();
+                    std::uint64_t hash = map->get_state_hash();
+                    auto middle = std::chrono::steady_clock::now();
+                    std::uint64_t full = hash_grid(map->get_influence_map().data(), size, size);
+                    auto end = std::chrono::steady_clock::now();
+                    if (map == maps[1]) {
+                        incremental_hash_ns += std::chrono::duration<double, std::nano>(middle - start).count();
+                        full_hash_ns += std::chrono::duration<double, std::nano>(end - middle).count();
+                    }
+
+                    hashes_ok = hashes_ok && hash == full;
+                    combined = combined * 31 + hash;
+                }
+                tick_hashes.push_back(combined);
+            };
+
+            for (double frame : frames) {
+                std::uint64_t pending = scheduler.get_pending_ticks();
+                int ran = scheduler.update(frame, step);
+                // a frame runs everything owed up to the cap, never more
+                schedule_ok = schedule_ok && ran <= scheduler.get_max_ticks_per_update()
+                    && (ran == scheduler.get_max_ticks_per_update() || scheduler.get_pending_ticks() == 0)
+                    && static_cast<std::uint64_t>(ran) >= std::min<std::uint64_t>(pending, 4);
+                if (scheduler.get_tick() >= static_cast<std::uint64_t>(ticks)) {
+                    break;
+                }
+            }
+            tick_hashes.resize(std::min<std::size_t>(tick_hashes.size(), ticks));
+            runs.push_back(tick_hashes);
+        }
+    }
+    set_simd_level(best);
+
+    bool runs_ok = runs[0].size() == static_cast<std::size_t>(ticks)
+        && std::all_of(runs.begin(), runs.end(), [&](const auto& run) { return run == runs[0]; });
+    double hashed_tiles = static_cast<double>(runs.size()) * ticks * size * size;
+
+    std::printf("\nlockstep, 3 maps at %dx%d, %d ticks, %zu runs (SIMD levels x 0, 1, 3 threads)\n", size, size, ticks, runs.size());
+    std::printf("%-12s %s, last tick %016llx\n", "ticks", runs_ok ? "identical" : "DESYNC", static_cast<unsigned long long>(runs[0].back()));
+    std::printf("%-12s %s\n", "schedule", schedule_ok ? "ok" : "WRONG");
+    std::printf("%-12s %10.3f ns/tile on the incremental map\n", "full hash", full_hash_ns / hashed_tiles);
+    std::printf("%-12s %10.3f ns/tile %s\n", "incremental", incremental_hash_ns / hashed_tiles, hashes_ok ? "matches" : "MISMATCH");
+
+    return runs_ok && schedule_ok && hashes_ok;
+}
+
+int main(int argc, char** argv) {
+    int max_size = argc > 1 ? std::atoi(argv[1]) : 4096;
+    long long min_tiles = argc > 2 ? std::atoll(argv[2]) : (1LL << 26);
+    int threads = argc > 3 ? std::atoi(argv[3]) : 0;
+
+    const int source_counts[] = {1, 64, 4096};
+    const float wall_densities[] = {0.0f, 0.1f, 0.3f};
+
+    if (!verify_simd_levels() || !verify_stencil_weights()) {
+        return 1;
+    }
+
+    std::printf("\nkernel: %s\n", get_simd_level_name(get_simd_level()));
+    std::printf("%-12s %8s %6s %8s %10s %14s\n", "grid", "sources", "walls", "iters", "ns/tile", "tiles/sec");
+
+    for (int size = 64; size <= max_size; size *= 2) {
+        for (int sources : source_counts) {
+            for (float wall_density : wall_densities) {
+                BenchConfig config = {size, sources, wall_density};
+                BenchResult result = run_config(config, min_tiles);
+
+                char grid[32];
+                std::snprintf(grid, sizeof(grid), "%dx%d", size, size);
+                std::printf("%-12s %8d %6.2f %8d %10.3f %14.4g\n", grid, sources, wall_density,
+                        result.iterations, result.ns_per_tile, result.tiles_per_sec);
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    run_stencils(std::min(max_size, 1024), min_tiles);
+    run_terrain(std::min(max_size, 1024), min_tiles);
+
+    if (!run_batch(std::min(max_size, 1024), 12, min_tiles, threads)) {
+        return 1;
+    }
+
+    if (!run_incremental(std::min(max_size, 2048), min_tiles)) {
+        return 1;
+    }
+
+    run_source_churn(std::min(max_size, 1024), 10000, 100);
+
+    for (bool terrain : {false, true}) {
+        if (!run_steady_state(std::min(max_size, 256), Stencil::FOUR, terrain) || !run_steady_state(std::min(max_size, 256), Stencil::EIGHT, terrain)) {
+            return 1;
+        }
+    }
+
+    // patches cover most of a small world, the hierarchy only pays off from about 512x512 up so it always
+    // runs at 1024x1024 or more as well
+    run_hierarchical(std::min(max_size, 256), 16, 200);
+    run_hierarchical(std::max(std::min(max_size, 2048), 1024), 16, 200);
+    // influence covers a good part of a small map, where the dense map steps faster, the sparse map is
+    // meant for large mostly empty worlds so it always runs at 4096x4096 as well
+    run_sparse(std::min(max_size, 256), 24, 60);
+    run_sparse(4096, 24, 60);
+
+    // 1 and 3 layers run on narrower strides and kernels than 8
+    for (int layer_count : {1, 3, 8}) {
+        if (!run_layers(std::min(max_size, 2048), layer_count, min_tiles)) {
+            return 1;
+        }
+    }
+
+    if (!run_composite(std::min(max_size, 1024), 50)) {
+        return 1;
+    }
+
+    if (!run_queries(std::min(max_size, 1024), 2000, threads)) {
+        return 1;
+    }
+
+    if (!run_async(std::min(max_size, 512), 200)) {
+        return 1;
+    }
+
+    if (!run_file(std::min(max_size, 2048), 2)) {
+        return 1;
+    }
+
+    if (!run_compact(std::min(max_size, 2048), 300, min_tiles)) {
+        return 1;
+    }
+
+    if (!run_profile(std::min(max_size, 512), 100, threads)) {
+        return 1;
+    }
+
+    if (!run_lockstep(std::min(max_size, 256), 150)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include <algorithm>
+
+#include <chunk_pool.hpp>
+
+ChunkPool::ChunkPool(int chunk_floats, int chunks_per_slab) :
+    chunk_floats(chunk_floats),
+    chunks_per_slab(std::max(chunks_per_slab, 1)),
+    in_use(0),
+    zero_chunk(new float[chunk_floats]()) {}
+
+float* ChunkPool::allocate() {
+    if (free_chunks.empty()) {
+        slabs.emplace_back(new float[static_cast<std::size_t>(chunks_per_slab) * chunk_floats]);
+        for (int i = chunks_per_slab - 1; i >= 0; --i) {
+            free_chunks.push_back(slabs.back().get() + static_cast<std::size_t>(i) * chunk_floats);
+        }
+    }
+
+    float* chunk = free_chunks.back();
+    free_chunks.pop_back();
+    std::fill(chunk, chunk + chunk_floats, 0.0f);
+    ++in_use;
+    return chunk;
+}
+
+void ChunkPool::release(float* chunk) {
+    if (chunk != nullptr) {
+        free_chunks.push_back(chunk);
+        --in_use;
+    }
+}
@@ -1,23 +1,179 @@
 #include <algorithm>
-#include <allegro5/allegro.h>
-#include <allegro5/allegro_primitives.h>
+#include <bit>
 
 #include <collision_map.hpp>
 
+namespace {
+
+// mask covering bits [first, last) of a single word
+std::uint64_t bit_range(int first, int last) {
+    std::uint64_t high = last >= 64 ? ~0ULL : (1ULL << last) - 1;
+    std::uint64_t low = (1ULL << first) - 1;
+    return high & ~low;
+}
+
+}
+
 CollisionMap::CollisionMap(int width, int height, int tile_size) :
-    width(width), height(height), tile_size(tile_size), collision_tiles(width * height) {}
+    width(width), height(height), tile_size(tile_size),
+    words_per_row((width + 63) / 64),
+    collision_words(static_cast<std::size_t>((width + 63) / 64) * height, 0),
+    blocks_x((width + BLOCK_SIZE - 1) / BLOCK_SIZE),
+    blocks_y((height + BLOCK_SIZE - 1) / BLOCK_SIZE),
+    revision(0),
+    block_revisions(static_cast<std::size_t>(blocks_x) * blocks_y, 0) {}
 
 void CollisionMap::set_blocked(int tile_x, int tile_y, bool blocked) {
     if (tile_x >= 0 && tile_y >= 0 && tile_x < width && tile_y < height) {
-        collision_tiles[width * tile_y + tile_x] = blocked;
+        std::uint64_t& word = collision_words[words_per_row * tile_y + (tile_x >> 6)];
+        std::uint64_t bit = 1ULL << (tile_x & 63);
+        std::uint64_t updated = blocked ? (word | bit) : (word & ~bit);
+
+        // dragging the editor brush sets the same tile every frame, only real changes count
+        if (updated != word) {
+            word = updated;
+            touch_rect(tile_x, tile_y, tile_x + 1, tile_y + 1);
+        }
     }
 }
 
 const bool CollisionMap::is_blocked(int tile_x, int tile_y) {
     if (tile_x >= 0 && tile_y >= 0 && tile_x < width && tile_y < height) {
-        return collision_tiles[width * tile_y + tile_x];
+        return (collision_words[words_per_row * tile_y + (tile_x >> 6)] >> (tile_x & 63)) & 1;
     }
     else{
         return true;
     }
-}
\ No newline at end of file
+}
+
+bool CollisionMap::clip_rect(int& x0, int& y0, int& x1, int& y1) const {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+    return x0 < x1 && y0 < y1;
+}
+
+void CollisionMap::set_blocked_rect(int tile_x, int tile_y, int rect_width, int rect_height, bool blocked) {
+    int x0 = tile_x, y0 = tile_y, x1 = tile_x + rect_width, y1 = tile_y + rect_height;
+    if (!clip_rect(x0, y0, x1, y1)) {
+        return;
+    }
+
+    int first_word = x0 >> 6;
+    int last_word = (x1 - 1) >> 6;
+
+    for (int y = y0; y < y1; ++y) {
+        std::uint64_t* row = &collision_words[words_per_row * y];
+
+        // whole words in the middle of the span are written directly, only the ends need masking
+        for (int w = first_word; w <= last_word; ++w) {
+            int first_bit = w == first_word ? (x0 & 63) : 0;
+            int last_bit = w == last_word ? ((x1 - 1) & 63) + 1 : 64;
+            std::uint64_t mask = bit_range(first_bit, last_bit);
+            row[w] = blocked ? (row[w] | mask) : (row[w] & ~mask);
+        }
+    }
+
+    touch_rect(x0, y0, x1, y1);
+}
+
+void CollisionMap::clear() {
+    std::fill(collision_words.begin(), collision_words.end(), 0);
+    touch_rect(0, 0, width, height);
+}
+
+void CollisionMap::assign_words(const std::uint64_t* words) {
+    std::copy_n(words, collision_words.size(), collision_words.begin());
+
+    // keep the padding bits zero whatever the source had in them
+    if (width % 64 != 0) {
+        std::uint64_t last_word_mask = (1ULL << (width % 64)) - 1;
+        for (int y = 0; y < height; ++y) {
+            collision_words[words_per_row * y + words_per_row - 1] &= last_word_mask;
+        }
+    }
+    touch_rect(0, 0, width, height);
+}
+
+void CollisionMap::set_terrain(int tile_x, int tile_y, std::uint8_t terrain_class) {
+    if (tile_x >= 0 && tile_y >= 0 && tile_x < width && tile_y < height && get_terrain(tile_x, tile_y) != terrain_class) {
+        if (terrain.empty()) {
+            terrain.assign(static_cast<std::size_t>(width) * height, 0);
+        }
+        terrain[static_cast<std::size_t>(width) * tile_y + tile_x] = terrain_class;
+        touch_rect(tile_x, tile_y, tile_x + 1, tile_y + 1);
+    }
+}
+
+void CollisionMap::set_terrain_rect(int tile_x, int tile_y, int rect_width, int rect_height, std::uint8_t terrain_class) {
+    int x0 = tile_x, y0 = tile_y, x1 = tile_x + rect_width, y1 = tile_y + rect_height;
+    if (!clip_rect(x0, y0, x1, y1) || (terrain.empty() && terrain_class == 0)) {
+        return;
+    }
+
+    if (terrain.empty()) {
+        terrain.assign(static_cast<std::size_t>(width) * height, 0);
+    }
+    for (int y = y0; y < y1; ++y) {
+        std::fill_n(&terrain[static_cast<std::size_t>(width) * y + x0], x1 - x0, terrain_class);
+    }
+
+    touch_rect(x0, y0, x1, y1);
+}
+
+const std::uint8_t CollisionMap::get_terrain(int tile_x, int tile_y) const {
+    if (terrain.empty() || tile_x < 0 || tile_y < 0 || tile_x >= width || tile_y >= height) {
+        return 0;
+    }
+    return terrain[static_cast<std::size_t>(width) * tile_y + tile_x];
+}
+
+void CollisionMap::clear_terrain() {
+    if (!terrain.empty()) {
+        terrain.clear();
+        terrain.shrink_to_fit();
+        touch_rect(0, 0, width, height);
+    }
+}
+
+void CollisionMap::assign_terrain(const std::uint8_t* classes) {
+    terrain.assign(classes, classes + static_cast<std::size_t>(width) * height);
+    touch_rect(0, 0, width, height);
+}
+
+void CollisionMap::touch_rect(int x0, int y0, int x1, int y1) {
+    ++revision;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    for (int by = y0 / BLOCK_SIZE; by <= (y1 - 1) / BLOCK_SIZE; ++by) {
+        for (int bx = x0 / BLOCK_SIZE; bx <= (x1 - 1) / BLOCK_SIZE; ++bx) {
+            block_revisions[blocks_x * by + bx] = revision;
+        }
+    }
+}
+
+int CollisionMap::count_blocked(int tile_x, int tile_y, int rect_width, int rect_height) const {
+    int x0 = tile_x, y0 = tile_y, x1 = tile_x + rect_width, y1 = tile_y + rect_height;
+    if (!clip_rect(x0, y0, x1, y1)) {
+        return 0;
+    }
+
+    int first_word = x0 >> 6;
+    int last_word = (x1 - 1) >> 6;
+    int count = 0;
+
+    for (int y = y0; y < y1; ++y) {
+        const std::uint64_t* row = get_row_words(y);
+
+        for (int w = first_word; w <= last_word; ++w) {
+            int first_bit = w == first_word ? (x0 & 63) : 0;
+            int last_bit = w == last_word ? ((x1 - 1) & 63) + 1 : 64;
+            count += std::popcount(row[w] & bit_range(first_bit, last_bit));
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include <compact_influence_map.hpp>
+
+CompactInfluenceMap::CompactInfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, float strength, float decay,
+        float momentum, bool collision_enabled, float range) :
+    name(name),
+    collision_map(collision_map),
+    collision_enabled(collision_enabled),
+    width(collision_map->get_width()),
+    height(collision_map->get_height()),
+    strength(strength),
+    decay(decay),
+    momentum(momentum),
+    range(range > 0.0f ? range : std::max(std::abs(strength), 1e-6f)),
+    scale(this->range / FIXED_MAX),
+    values(static_cast<std::size_t>(width) * height, 0),
+    buffer(static_cast<std::size_t>(width) * height, 0),
+    border_row(width, 0),
+    generation(0),
+    step_coefficient(0.0f),
+    step_kernel(nullptr) {}
+
+SourceHandle CompactInfluenceMap::add_source(int tile_x, int tile_y, float source_strength) {
+    if (!on_map(tile_x, tile_y)) {
+        return {};
+    }
+    return sources.add(tile_x, tile_y, source_strength);
+}
+
+SourceHandle CompactInfluenceMap::add_source(int tile_x, int tile_y) {
+    return add_source(tile_x, tile_y, strength);
+}
+
+bool CompactInfluenceMap::remove_source(SourceHandle handle) {
+    return sources.remove(handle);
+}
+
+bool CompactInfluenceMap::move_source(SourceHandle handle, int tile_x, int tile_y) {
+    InfluenceSource* src = sources.get(handle);
+    if (src == nullptr || !on_map(tile_x, tile_y)) {
+        return false;
+    }
+
+    src->x = tile_x;
+    src->y = tile_y;
+    return true;
+}
+
+bool CompactInfluenceMap::set_source_strength(SourceHandle handle, float source_strength) {
+    InfluenceSource* src = sources.get(handle);
+    if (src == nullptr) {
+        return false;
+    }
+
+    src->strength = source_strength;
+    return true;
+}
+
+void CompactInfluenceMap::clear_sources() {
+    sources.clear();
+}
+
+void CompactInfluenceMap::recalculate(ThreadPool* pool) {
+    // sources are stamped into the front buffer like InfluenceMap does, quantized once per step
+    for (const auto& src : sources.get_sources()) {
+        values[static_cast<std::size_t>(width) * src.y + src.x] = quantize(src.strength);
+    }
+
+    // same coefficient expression as InfluenceMap so both paths decay by the same float
+    step_coefficient = expf(-1.0 * decay);
+    step_kernel = get_propagate_fixed_row(get_simd_level());
+
+    if (pool != nullptr && pool->get_concurrency() > 1) {
+        int band = std::max(height / (pool->get_concurrency() * 4), 1);
+        band = (band + CollisionMap::BLOCK_SIZE - 1) / CollisionMap::BLOCK_SIZE * CollisionMap::BLOCK_SIZE;
+
+        std::vector<std::function<void()>> tasks;
+        for (int first = 0; first < height; first += band) {
+            int last = std::min(first + band, height);
+            tasks.push_back([this, first, last]() { recalculate_rows(first, last); });
+        }
+        pool->run(tasks);
+    }
+    else {
+        recalculate_rows(0, height);
+    }
+
+    values.swap(buffer);
+    ++generation;
+}
+
+void CompactInfluenceMap::recalculate_rows(int first, int last) {
+    for (int y = first; y < last; ++y) {
+        const std::int16_t* mid = &values[static_cast<std::size_t>(width) * y];
+        const std::int16_t* up = y > 0 ? mid - width : border_row.data();
+        const std::int16_t* down = y < height - 1 ? mid + width : border_row.data();
+        const std::uint64_t* blocked = collision_enabled ? collision_map->get_row_words(y) : nullptr;
+
+        step_kernel(up, mid, down, blocked, &buffer[static_cast<std::size_t>(width) * y], 0, width, width, step_coefficient, momentum);
+    }
+}
+
+float CompactInfluenceMap::get_influence(int tile_x, int tile_y) const {
+    if (!on_map(tile_x, tile_y)) {
+        return 0.0f;
+    }
+    return values[static_cast<std::size_t>(width) * tile_y + tile_x] * scale;
+}
+
+void CompactInfluenceMap::copy_influence(std::vector<float>& out) const {
+    out.resize(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        out[i] = values[i] * scale;
+    }
+}
+
+const float CompactInfluenceMap::get_error_bound() const {
+    float contraction = momentum * (1.0f - std::exp(-decay));
+    if (contraction <= 0.0f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return 0.5f * scale / contraction;
+}
+
+std::int16_t CompactInfluenceMap::quantize(float value) const {
+    float quanta = std::clamp(value / scale, -FIXED_MAX, FIXED_MAX);
+    return static_cast<std::int16_t>(std::nearbyint(quanta));
+}
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <composite_map.hpp>
+
+MapExpr MapExpr::layer(std::shared_ptr<InfluenceMap> map) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::LAYER, 0.0f, map, nullptr, nullptr}));
+}
+
+MapExpr MapExpr::constant(float value) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::CONSTANT, value, nullptr, nullptr, nullptr}));
+}
+
+MapExpr MapExpr::add(const MapExpr& a, const MapExpr& b) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::ADD, 0.0f, nullptr, a.node, b.node}));
+}
+
+MapExpr MapExpr::sub(const MapExpr& a, const MapExpr& b) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::SUB, 0.0f, nullptr, a.node, b.node}));
+}
+
+MapExpr MapExpr::min(const MapExpr& a, const MapExpr& b) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::MIN, 0.0f, nullptr, a.node, b.node}));
+}
+
+MapExpr MapExpr::max(const MapExpr& a, const MapExpr& b) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::MAX, 0.0f, nullptr, a.node, b.node}));
+}
+
+MapExpr MapExpr::scale(const MapExpr& a, float factor) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::SCALE, factor, nullptr, a.node, nullptr}));
+}
+
+MapExpr MapExpr::abs(const MapExpr& a) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::ABS, 0.0f, nullptr, a.node, nullptr}));
+}
+
+MapExpr MapExpr::threshold(const MapExpr& a, float threshold) {
+    return MapExpr(std::make_shared<const Node>(Node{Op::THRESHOLD, threshold, nullptr, a.node, nullptr}));
+}
+
+CompositeMap::CompositeMap(const MapExpr& expr) :
+    bound(true),
+    width(0),
+    height(0),
+    register_count(0),
+    cache_valid(false) {
+    compile(*expr.node, 0);
+
+    if (!layers.empty()) {
+        width = layers[0]->get_width();
+        height = layers[0]->get_height();
+    }
+
+    // layers are read at the same flat offsets, a layer of another size would be read out of bounds
+    for (const auto& layer : layers) {
+        if (layer->get_width() != width || layer->get_height() != height) {
+            bound = false;
+            width = 0;
+            height = 0;
+            program.clear();
+            layers.clear();
+            register_count = 0;
+            break;
+        }
+    }
+
+    scratch.assign(static_cast<std::size_t>(register_count) * SEGMENT, 0.0f);
+    registers.assign(register_count, nullptr);
+    cached_generations.assign(layers.size(), 0);
+}
+
+void CompositeMap::compile(const MapExpr::Node& node, int depth) {
+    // the result of a subtree evaluated at depth d lands in register d, the right operand of a
+    // binary node goes one register up, so the register count is the depth of the tree
+    register_count = std::max(register_count, depth + 1);
+    Instruction instruction = {node.op, depth, depth, depth + 1, node.value, -1};
+
+    switch (node.op) {
+        case MapExpr::Op::LAYER: {
+            auto itr = std::find(layers.begin(), layers.end(), node.map);
+            instruction.layer = static_cast<int>(itr - layers.begin());
+            if (itr == layers.end()) {
+                layers.push_back(node.map);
+            }
+            break;
+        }
+        case MapExpr::Op::CONSTANT:
+            break;
+        case MapExpr::Op::SCALE:
+        case MapExpr::Op::ABS:
+        case MapExpr::Op::THRESHOLD:
+            compile(*node.a, depth);
+            break;
+        default:
+            compile(*node.a, depth);
+            compile(*node.b, depth + 1);
+            break;
+    }
+
+    program.push_back(instruction);
+}
+
+bool CompositeMap::is_cached() const {
+    if (!cache_valid) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        if (layers[i]->get_generation() != cached_generations[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const std::vector<float>& CompositeMap::evaluate() {
+    if (is_cached()) {
+        return cache;
+    }
+
+    // the operations are all element wise, so the grid is walked as one flat array
+    std::size_t tile_count = static_cast<std::size_t>(width) * height;
+    cache.resize(tile_count);
+    for (std::size_t offset = 0; offset < tile_count; offset += SEGMENT) {
+        run_segment(offset, static_cast<int>(std::min<std::size_t>(SEGMENT, tile_count - offset)), &cache[offset]);
+    }
+
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        cached_generations[i] = layers[i]->get_generation();
+    }
+    cache_valid = true;
+    return cache;
+}
+
+void CompositeMap::evaluate_rect(int tile_x, int tile_y, int rect_width, int rect_height, std::vector<float>& out) {
+    int x0 = std::max(tile_x, 0);
+    int y0 = std::max(tile_y, 0);
+    int x1 = std::min(tile_x + rect_width, width);
+    int y1 = std::min(tile_y + rect_height, height);
+    if (x0 >= x1 || y0 >= y1) {
+        out.clear();
+        return;
+    }
+
+    int clipped_width = x1 - x0;
+    out.resize(static_cast<std::size_t>(clipped_width) * (y1 - y0));
+    bool cached = is_cached();
+
+    for (int y = y0; y < y1; ++y) {
+        std::size_t row = static_cast<std::size_t>(width) * y;
+        float* dest = &out[static_cast<std::size_t>(clipped_width) * (y - y0)];
+
+        if (cached) {
+            std::memcpy(dest, &cache[row + x0], clipped_width * sizeof(float));
+            continue;
+        }
+
+        for (int x = x0; x < x1; x += SEGMENT) {
+            run_segment(row + x, std::min(SEGMENT, x1 - x), dest + (x - x0));
+        }
+    }
+}
+
+float CompositeMap::get_value(int tile_x, int tile_y) {
+    if (tile_x < 0 || tile_y < 0 || tile_x >= width || tile_y >= height) {
+        return 0.0f;
+    }
+
+    if (is_cached()) {
+        return cache[static_cast<std::size_t>(width) * tile_y + tile_x];
+    }
+
+    float value;
+    run_segment(static_cast<std::size_t>(width) * tile_y + tile_x, 1, &value);
+    return value;
+}
+
+void CompositeMap::run_segment(std::size_t offset, int count, float* out) {
+    for (const Instruction& instruction : program) {
+        float* dst = &scratch[static_cast<std::size_t>(instruction.dst) * SEGMENT];
+        const float* a = registers[instruction.a];
+        const float* b = instruction.b < register_count ? registers[instruction.b] : nullptr;
+        const float value = instruction.value;
+
+        switch (instruction.op) {
+            case MapExpr::Op::LAYER:
+                // layers are read in place, only results of operations need scratch space
+                registers[instruction.dst] = layers[instruction.layer]->get_influence_map().data() + offset;
+                continue;
+            case MapExpr::Op::CONSTANT:
+                std::fill_n(dst, count, value);
+                break;
+            case MapExpr::Op::ADD:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = a[i] + b[i];
+                }
+                break;
+            case MapExpr::Op::SUB:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = a[i] - b[i];
+                }
+                break;
+            case MapExpr::Op::MIN:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = b[i] < a[i] ? b[i] : a[i];
+                }
+                break;
+            case MapExpr::Op::MAX:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = a[i] < b[i] ? b[i] : a[i];
+                }
+                break;
+            case MapExpr::Op::SCALE:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = a[i] * value;
+                }
+                break;
+            case MapExpr::Op::ABS:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = std::abs(a[i]);
+                }
+                break;
+            case MapExpr::Op::THRESHOLD:
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = a[i] >= value ? a[i] : 0.0f;
+                }
+                break;
+        }
+
+        registers[instruction.dst] = dst;
+    }
+
+    std::memcpy(out, registers[0], count * sizeof(float));
+}
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cmath>
+
+#include <hierarchical_influence_map.hpp>
+#include <parallel_update.hpp>
+
+namespace {
+
+// word w of a row of width tiles, tiles off the row (padding and words outside it) read as blocked
+// like is_blocked() does
+std::uint64_t row_word(const std::uint64_t* row, int width, int w) {
+    if (w < 0 || w >= (width + 63) / 64) {
+        return ~0ULL;
+    }
+    int tiles = width - w * 64;
+    return tiles >= 64 ? row[w] : row[w] | ~((1ULL << tiles) - 1);
+}
+
+// the 64 tiles of a row starting at tile_x, which may lie off the row
+std::uint64_t row_bits(const std::uint64_t* row, int width, int tile_x) {
+    int w = tile_x >= 0 ? tile_x / 64 : (tile_x - 63) / 64;
+    int shift = tile_x - w * 64;
+    std::uint64_t bits = row_word(row, width, w) >> shift;
+    return shift == 0 ? bits : bits | row_word(row, width, w + 1) << (64 - shift);
+}
+
+}
+
+HierarchicalInfluenceMap::HierarchicalInfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, int factor,
+        float strength, float decay, float momentum, int patch_size) :
+    name(name),
+    collision_map(collision_map),
+    factor(std::max(factor, 1)),
+    patch_size(std::max(patch_size, 1)),
+    strength(strength),
+    decay(decay),
+    momentum(momentum),
+    patches_x((collision_map->get_width() + this->patch_size - 1) / this->patch_size),
+    patches_y((collision_map->get_height() + this->patch_size - 1) / this->patch_size),
+    collision_revision(collision_map->get_revision()) {
+    int coarse_width = (collision_map->get_width() + this->factor - 1) / this->factor;
+    int coarse_height = (collision_map->get_height() + this->factor - 1) / this->factor;
+    coarse_collision = std::make_shared<CollisionMap>(coarse_width, coarse_height, collision_map->get_tile_size() * this->factor);
+
+    for (int cy = 0; cy < coarse_height; ++cy) {
+        for (int cx = 0; cx < coarse_width; ++cx) {
+            rebuild_coarse_tile(cx, cy);
+        }
+    }
+
+    // one coarse step covers factor fine tiles, so the decay per coarse tile is scaled to match
+    coarse_map = std::make_unique<InfluenceMap>(name + " (coarse)", coarse_collision, strength, decay * this->factor, momentum);
+}
+
+SourceHandle HierarchicalInfluenceMap::add_source(int tile_x, int tile_y, float source_strength) {
+    if (tile_x < 0 || tile_y < 0 || tile_x >= collision_map->get_width() || tile_y >= collision_map->get_height()) {
+        return {};
+    }
+
+    SourceHandle handle = sources.add(tile_x, tile_y, source_strength);
+    source_links[handle.slot] = {handle, coarse_map->add_source(tile_x / factor, tile_y / factor, source_strength), -1, SourceHandle{}};
+    return handle;
+}
+
+bool HierarchicalInfluenceMap::remove_source(SourceHandle handle) {
+    if (sources.get(handle) == nullptr) {
+        return false;
+    }
+
+    SourceLink& link = source_links[handle.slot];
+    coarse_map->remove_source(link.coarse);
+    unlink_patch_source(link);
+    source_links.erase(handle.slot);
+    return sources.remove(handle);
+}
+
+bool HierarchicalInfluenceMap::move_source(SourceHandle handle, int tile_x, int tile_y) {
+    InfluenceSource* src = sources.get(handle);
+    if (src == nullptr || tile_x < 0 || tile_y < 0 || tile_x >= collision_map->get_width() || tile_y >= collision_map->get_height()) {
+        return false;
+    }
+
+    src->x = tile_x;
+    src->y = tile_y;
+    return coarse_map->move_source(source_links[handle.slot].coarse, tile_x / factor, tile_y / factor);
+}
+
+void HierarchicalInfluenceMap::request_detail(int tile_x, int tile_y, int rect_width, int rect_height, int ttl) {
+    int first_x = std::max(tile_x, 0) / patch_size;
+    int first_y = std::max(tile_y, 0) / patch_size;
+    int last_x = std::min(tile_x + rect_width - 1, collision_map->get_width() - 1) / patch_size;
+    int last_y = std::min(tile_y + rect_height - 1, collision_map->get_height() - 1) / patch_size;
+
+    for (int py = first_y; py <= last_y; ++py) {
+        for (int px = first_x; px <= last_x; ++px) {
+            touch_patch(px, py, ttl);
+        }
+    }
+}
+
+void HierarchicalInfluenceMap::recalculate(ThreadPool* pool) {
+    refresh_collision();
+    coarse_map->recalculate();
+
+    // every source keeps the patch it stands in refined
+    for (const auto& src : sources.get_sources()) {
+        touch_patch(src.x / patch_size, src.y / patch_size, 2);
+    }
+
+    // the halo ring is pinned to the coarse field, sources that moved follow into their patch in place
+    for (auto& [key, patch] : patches) {
+        update_halo(patch);
+    }
+
+    for (auto& [slot, link] : source_links) {
+        update_patch_source(link, *sources.get(link.source));
+    }
+
+    std::vector<std::shared_ptr<InfluenceMap>> patch_maps;
+    for (auto& [key, patch] : patches) {
+        patch_maps.push_back(patch.influence);
+    }
+
+    if (pool != nullptr) {
+        recalculate_parallel(*pool, patch_maps);
+    }
+    else {
+        for (auto& inf : patch_maps) {
+            inf->recalculate();
+        }
+    }
+
+    // patches nobody asked for in a while are dropped, along with the handles of sources stamped into them
+    for (auto itr = patches.begin(); itr != patches.end();) {
+        if (--itr->second.ttl <= 0) {
+            for (auto& [slot, link] : source_links) {
+                if (link.patch == itr->first) {
+                    link.patch = -1;
+                    link.fine = {};
+                }
+            }
+            itr = patches.erase(itr);
+        }
+        else {
+            ++itr;
+        }
+    }
+}
+
+float HierarchicalInfluenceMap::sample(int tile_x, int tile_y) const {
+    if (tile_x < 0 || tile_y < 0 || tile_x >= collision_map->get_width() || tile_y >= collision_map->get_height()) {
+        return 0.0f;
+    }
+
+    auto itr = patches.find(patch_key(tile_x / patch_size, tile_y / patch_size));
+    if (itr != patches.end()) {
+        int local_x = tile_x % patch_size + 1;
+        int local_y = tile_y % patch_size + 1;
+        return itr->second.influence->get_influence_map()[(patch_size + 2) * local_y + local_x];
+    }
+
+    return sample_coarse((tile_x + 0.5f) / factor - 0.5f, (tile_y + 0.5f) / factor - 0.5f);
+}
+
+float HierarchicalInfluenceMap::sample_coarse(float coarse_x, float coarse_y) const {
+    int coarse_width = coarse_collision->get_width();
+    int coarse_height = coarse_collision->get_height();
+    const auto& values = coarse_map->get_influence_map();
+
+    // bilinear between coarse tile centers, clamped at the edges
+    coarse_x = std::clamp(coarse_x, 0.0f, static_cast<float>(coarse_width - 1));
+    coarse_y = std::clamp(coarse_y, 0.0f, static_cast<float>(coarse_height - 1));
+    int x0 = static_cast<int>(coarse_x);
+    int y0 = static_cast<int>(coarse_y);
+    int x1 = std::min(x0 + 1, coarse_width - 1);
+    int y1 = std::min(y0 + 1, coarse_height - 1);
+    float fx = coarse_x - x0;
+    float fy = coarse_y - y0;
+
+    float top = std::lerp(values[coarse_width * y0 + x0], values[coarse_width * y0 + x1], fx);
+    float bottom = std::lerp(values[coarse_width * y1 + x0], values[coarse_width * y1 + x1], fx);
+    return std::lerp(top, bottom, fy);
+}
+
+void HierarchicalInfluenceMap::refresh_collision() {
+    if (collision_map->get_revision() == collision_revision) {
+        return;
+    }
+
+    // only coarse tiles and patches under changed collision blocks are rebuilt
+    for (int by = 0; by < collision_map->get_blocks_y(); ++by) {
+        for (int bx = 0; bx < collision_map->get_blocks_x(); ++bx) {
+            if (collision_map->get_block_revision(bx, by) <= collision_revision) {
+                continue;
+            }
+
+            int x0 = bx * CollisionMap::BLOCK_SIZE;
+            int y0 = by * CollisionMap::BLOCK_SIZE;
+            int x1 = std::min(x0 + CollisionMap::BLOCK_SIZE, collision_map->get_width()) - 1;
+            int y1 = std::min(y0 + CollisionMap::BLOCK_SIZE, collision_map->get_height()) - 1;
+
+            for (int cy = y0 / factor; cy <= y1 / factor; ++cy) {
+                for (int cx = x0 / factor; cx <= x1 / factor; ++cx) {
+                    rebuild_coarse_tile(cx, cy);
+                }
+            }
+
+            // patches read one tile past their edge, so neighbours of the block count too
+            for (int py = std::max(y0 - 1, 0) / patch_size; py <= std::min(y1 + 1, collision_map->get_height() - 1) / patch_size; ++py) {
+                for (int px = std::max(x0 - 1, 0) / patch_size; px <= std::min(x1 + 1, collision_map->get_width() - 1) / patch_size; ++px) {
+                    auto itr = patches.find(patch_key(px, py));
+                    if (itr != patches.end()) {
+                        copy_patch_collision(itr->second);
+                    }
+                }
+            }
+        }
+    }
+
+    collision_revision = collision_map->get_revision();
+}
+
+void HierarchicalInfluenceMap::rebuild_coarse_tile(int coarse_x, int coarse_y) {
+    int x0 = coarse_x * factor;
+    int y0 = coarse_y * factor;
+    int w = std::min(factor, collision_map->get_width() - x0);
+    int h = std::min(factor, collision_map->get_height() - y0);
+
+    // conservative: a single open fine tile keeps the coarse tile open so no passage is ever cut off
+    coarse_collision->set_blocked(coarse_x, coarse_y, collision_map->count_blocked(x0, y0, w, h) == w * h);
+}
+
+void HierarchicalInfluenceMap::copy_patch_collision(Patch& patch) {
+    int origin_x = patch.patch_x * patch_size - 1;
+    int origin_y = patch.patch_y * patch_size - 1;
+    int extent = patch_size + 2;
+    int width = collision_map->get_width();
+    int height = collision_map->get_height();
+    int words_per_row = patch.collision->get_words_per_row();
+
+    // whole words shifted into place, rows off the map are blocked, assign_words() clears the padding and
+    // touches the patch once
+    std::vector<std::uint64_t> words(static_cast<std::size_t>(words_per_row) * extent, ~0ULL);
+    for (int y = 0; y < extent; ++y) {
+        int source_y = origin_y + y;
+        if (source_y < 0 || source_y >= height) {
+            continue;
+        }
+        const std::uint64_t* row = collision_map->get_row_words(source_y);
+        for (int w = 0; w < words_per_row; ++w) {
+            words[static_cast<std::size_t>(words_per_row) * y + w] = row_bits(row, width, origin_x + w * 64);
+        }
+    }
+    patch.collision->assign_words(words.data());
+}
+
+void HierarchicalInfluenceMap::update_halo(Patch& patch) {
+    int origin_x = patch.patch_x * patch_size - 1;
+    int origin_y = patch.patch_y * patch_size - 1;
+    InfluenceMap& inf = *patch.influence;
+
+    for (SourceHandle handle : patch.halo_sources) {
+        const InfluenceSource* tile = inf.get_sources().get(handle);
+        inf.set_source_strength(handle, sample_coarse((origin_x + tile->x + 0.5f) / factor - 0.5f, (origin_y + tile->y + 0.5f) / factor - 0.5f));
+    }
+}
+
+void HierarchicalInfluenceMap::update_patch_source(SourceLink& link, const InfluenceSource& src) {
+    std::int64_t key = patch_key(src.x / patch_size, src.y / patch_size);
+    auto itr = patches.find(key);
+    if (link.patch != key) {
+        unlink_patch_source(link);
+    }
+    if (itr == patches.end()) {
+        return;
+    }
+
+    Patch& patch = itr->second;
+    int local_x = src.x - patch.patch_x * patch_size + 1;
+    int local_y = src.y - patch.patch_y * patch_size + 1;
+    if (link.patch == key) {
+        patch.influence->move_source(link.fine, local_x, local_y);
+    }
+    else {
+        // halo sources are never removed, so sources added after them stay behind them in the stamping order
+        // and win on shared tiles
+        link.patch = key;
+        link.fine = patch.influence->add_source(local_x, local_y, src.strength);
+    }
+}
+
+void HierarchicalInfluenceMap::unlink_patch_source(SourceLink& link) {
+    if (link.patch < 0) {
+        return;
+    }
+
+    auto itr = patches.find(link.patch);
+    if (itr != patches.end()) {
+        itr->second.influence->remove_source(link.fine);
+    }
+    link.patch = -1;
+    link.fine = {};
+}
+
+HierarchicalInfluenceMap::Patch& HierarchicalInfluenceMap::touch_patch(int patch_x, int patch_y, int ttl) {
+    auto itr = patches.find(patch_key(patch_x, patch_y));
+    if (itr != patches.end()) {
+        itr->second.ttl = std::max(itr->second.ttl, ttl);
+        return itr->second;
+    }
+
+    int extent = patch_size + 2;
+    Patch patch;
+    patch.patch_x = patch_x;
+    patch.patch_y = patch_y;
+    patch.ttl = ttl;
+    patch.collision = std::make_shared<CollisionMap>(extent, extent, collision_map->get_tile_size());
+    copy_patch_collision(patch);
+    patch.influence = std::make_shared<InfluenceMap>(name, patch.collision, strength, decay, momentum);
+
+    // start from the coarse field so a new patch does not have to fill in from zero
+    int origin_x = patch_x * patch_size - 1;
+    int origin_y = patch_y * patch_size - 1;
+    for (int y = 0; y < extent; ++y) {
+        for (int x = 0; x < extent; ++x) {
+            float value = sample_coarse((origin_x + x + 0.5f) / factor - 0.5f, (origin_y + y + 0.5f) / factor - 0.5f);
+            patch.influence->set_influence(x, y, value);
+        }
+    }
+
+    // each ring tile once, the strengths are filled in by update_halo() every step
+    for (int i = 0; i < extent; ++i) {
+        patch.halo_sources.push_back(patch.influence->add_source(i, 0, 0.0f));
+        patch.halo_sources.push_back(patch.influence->add_source(i, extent - 1, 0.0f));
+    }
+    for (int i = 1; i < extent - 1; ++i) {
+        patch.halo_sources.push_back(patch.influence->add_source(0, i, 0.0f));
+        patch.halo_sources.push_back(patch.influence->add_source(extent - 1, i, 0.0f));
+    }
+
+    return patches.emplace(patch_key(patch_x, patch_y), std::move(patch)).first->second;
+}
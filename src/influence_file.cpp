@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <influence_file.hpp>
+
+using namespace influence_file;
+
+namespace {
+
+std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+bool write_at(std::FILE* file, std::uint64_t& position, std::uint64_t offset, const void* bytes, std::size_t count) {
+    static const char padding[SECTION_ALIGNMENT] = {};
+    while (position < offset) {
+        std::size_t gap = static_cast<std::size_t>(std::min<std::uint64_t>(offset - position, SECTION_ALIGNMENT));
+        if (std::fwrite(padding, 1, gap, file) != gap) {
+            return false;
+        }
+        position += gap;
+    }
+
+    if (count > 0 && std::fwrite(bytes, 1, count, file) != count) {
+        return false;
+    }
+    position += count;
+    return true;
+}
+
+// true when [offset, offset + bytes) lies inside a file of size bytes and offset is a multiple of alignment
+bool section_fits(std::uint64_t offset, std::uint64_t bytes, std::uint64_t size, std::uint64_t alignment) {
+    return offset % alignment == 0 && offset <= size && bytes <= size - offset;
+}
+
+}
+
+bool save_influence_file(const std::string& path, CollisionMap& collision_map, const std::vector<std::shared_ptr<InfluenceMap>>& maps) {
+    std::uint64_t tile_count = static_cast<std::uint64_t>(collision_map.get_width()) * collision_map.get_height();
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.width = collision_map.get_width();
+    header.height = collision_map.get_height();
+    header.tile_size = collision_map.get_tile_size();
+    header.words_per_row = collision_map.get_words_per_row();
+    header.layer_count = static_cast<std::uint32_t>(maps.size());
+
+    // lay the sections out first so the headers can be written in one go
+    std::uint64_t offset = sizeof(FileHeader) + sizeof(LayerHeader) * maps.size();
+    header.collision_offset = align_up(offset);
+    offset = header.collision_offset + collision_map.get_collision_words().size() * sizeof(std::uint64_t);
+    if (collision_map.has_terrain()) {
+        header.terrain_offset = align_up(offset);
+        offset = header.terrain_offset + tile_count;
+    }
+
+    std::vector<LayerHeader> layers(maps.size());
+    for (std::size_t i = 0; i < maps.size(); ++i) {
+        LayerHeader& layer = layers[i];
+        std::strncpy(layer.name, maps[i]->get_name().c_str(), NAME_LENGTH - 1);
+        layer.strength = maps[i]->get_strength();
+        layer.decay = maps[i]->get_decay();
+        layer.momentum = maps[i]->get_momentum();
+        layer.collision_enabled = maps[i]->is_collision_enabled() ? 1 : 0;
+        layer.stencil = static_cast<std::uint32_t>(maps[i]->get_stencil());
+        layer.combine_rule = static_cast<std::uint32_t>(maps[i]->get_combine_rule());
+        std::copy(maps[i]->get_stencil_weights().begin(), maps[i]->get_stencil_weights().end(), layer.stencil_weights);
+        layer.values_offset = align_up(offset);
+        layer.sources_offset = align_up(layer.values_offset + tile_count * sizeof(float));
+        layer.source_count = maps[i]->get_sources().size();
+        layer.terrain_costs_offset = align_up(layer.sources_offset + layer.source_count * sizeof(FileSource));
+        offset = layer.terrain_costs_offset + TERRAIN_CLASSES * sizeof(float);
+    }
+    header.file_size = offset;
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::uint64_t position = 0;
+    bool ok = write_at(file, position, 0, &header, sizeof(header)) &&
+        write_at(file, position, position, layers.data(), sizeof(LayerHeader) * layers.size()) &&
+        write_at(file, position, header.collision_offset, collision_map.get_collision_words().data(),
+                collision_map.get_collision_words().size() * sizeof(std::uint64_t));
+    if (ok && header.terrain_offset != 0) {
+        ok = write_at(file, position, header.terrain_offset, collision_map.get_terrain_classes().data(), tile_count);
+    }
+
+    std::vector<FileSource> sources;
+    float terrain_costs[TERRAIN_CLASSES];
+    for (std::size_t i = 0; ok && i < maps.size(); ++i) {
+        sources.clear();
+        for (const auto& src : maps[i]->get_sources().get_sources()) {
+            sources.push_back({src.x, src.y, src.strength});
+        }
+        for (int c = 0; c < TERRAIN_CLASSES; ++c) {
+            terrain_costs[c] = maps[i]->get_terrain_cost(static_cast<std::uint8_t>(c));
+        }
+
+        ok = write_at(file, position, layers[i].values_offset, maps[i]->get_influence_map().data(), tile_count * sizeof(float)) &&
+            write_at(file, position, layers[i].sources_offset, sources.data(), sources.size() * sizeof(FileSource)) &&
+            write_at(file, position, layers[i].terrain_costs_offset, terrain_costs, sizeof(terrain_costs));
+    }
+
+    return std::fclose(file) == 0 && ok;
+}
+
+MappedInfluenceFile::MappedInfluenceFile(char* data, std::size_t size) :
+    data(data),
+    size(size),
+    header() {}
+
+MappedInfluenceFile::~MappedInfluenceFile() {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+std::unique_ptr<MappedInfluenceFile> MappedInfluenceFile::open(const std::string& path) {
+    char* data = nullptr;
+    std::size_t size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+
+    LARGE_INTEGER file_size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= static_cast<LONGLONG>(FILE_HEADER_SIZE_V1)) {
+        size = static_cast<std::size_t>(file_size.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    }
+    if (mapping != nullptr) {
+        // FILE_MAP_COPY is the copy-on-write equivalent of MAP_PRIVATE
+        data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(FILE_HEADER_SIZE_V1)) {
+        size = static_cast<std::size_t>(info.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        data = mapping != MAP_FAILED ? static_cast<char*>(mapping) : nullptr;
+    }
+    close(fd);
+#endif
+
+    if (data == nullptr) {
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedInfluenceFile> mapped(new MappedInfluenceFile(data, size));
+    if (!mapped->read_headers() || !mapped->validate()) {
+        return nullptr;
+    }
+    return mapped;
+}
+
+bool MappedInfluenceFile::read_headers() {
+    // the version decides how large the headers in the file are, the fields an older version lacks stay 0
+    std::memcpy(&header, data, FILE_HEADER_SIZE_V1);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version < 1 || header.version > VERSION) {
+        return false;
+    }
+
+    std::size_t file_header_size = header.version == 1 ? FILE_HEADER_SIZE_V1 : sizeof(FileHeader);
+    std::size_t layer_header_size = header.version == 1 ? LAYER_HEADER_SIZE_V1 : sizeof(LayerHeader);
+    if (size < file_header_size || header.layer_count > (size - file_header_size) / layer_header_size) {
+        return false;
+    }
+    std::memcpy(&header, data, file_header_size);
+
+    layers.assign(header.layer_count, LayerHeader());
+    for (std::uint32_t i = 0; i < header.layer_count; ++i) {
+        std::memcpy(&layers[i], data + file_header_size + layer_header_size * i, layer_header_size);
+    }
+    return true;
+}
+
+bool MappedInfluenceFile::validate() const {
+    if (header.byte_order != BYTE_ORDER_MARK || header.file_size != size) {
+        return false;
+    }
+
+    if (header.width <= 0 || header.height <= 0 || header.tile_size <= 0 ||
+            header.words_per_row != static_cast<std::uint32_t>((header.width + 63) / 64)) {
+        return false;
+    }
+
+    std::uint64_t tile_count = static_cast<std::uint64_t>(header.width) * header.height;
+    std::uint64_t word_count = static_cast<std::uint64_t>(header.words_per_row) * header.height;
+    if (!section_fits(header.collision_offset, word_count * sizeof(std::uint64_t), size, sizeof(std::uint64_t)) ||
+            (header.terrain_offset != 0 && !section_fits(header.terrain_offset, tile_count, size, 1))) {
+        return false;
+    }
+
+    for (const LayerHeader& layer : layers) {
+        if (!section_fits(layer.values_offset, tile_count * sizeof(float), size, alignof(float)) ||
+                layer.source_count > size / sizeof(FileSource) ||
+                !section_fits(layer.sources_offset, layer.source_count * sizeof(FileSource), size, alignof(FileSource)) ||
+                (layer.terrain_costs_offset != 0 &&
+                    !section_fits(layer.terrain_costs_offset, TERRAIN_CLASSES * sizeof(float), size, alignof(float))) ||
+                layer.stencil > static_cast<std::uint32_t>(Stencil::WEIGHTED) ||
+                layer.combine_rule > static_cast<std::uint32_t>(CombineRule::SIGNED_MAX)) {
+            return false;
+        }
+
+        const FileSource* sources = reinterpret_cast<const FileSource*>(data + layer.sources_offset);
+        for (std::uint64_t s = 0; s < layer.source_count; ++s) {
+            if (sources[s].x < 0 || sources[s].y < 0 || sources[s].x >= header.width || sources[s].y >= header.height) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::string MappedInfluenceFile::get_layer_name(int layer) const {
+    const char* name = layers[layer].name;
+    return std::string(name, std::find(name, name + NAME_LENGTH, '\0'));
+}
+
+std::shared_ptr<CollisionMap> MappedInfluenceFile::copy_collision_map() {
+    auto collision_map = std::make_shared<CollisionMap>(header.width, header.height, header.tile_size);
+    collision_map->assign_words(get_collision_words());
+    if (get_terrain() != nullptr) {
+        collision_map->assign_terrain(get_terrain());
+    }
+    return collision_map;
+}
+
+std::shared_ptr<InfluenceMap> MappedInfluenceFile::copy_influence_map(int layer, std::shared_ptr<CollisionMap> collision_map) {
+    const LayerHeader& info = layers[layer];
+    auto inf = std::make_shared<InfluenceMap>(get_layer_name(layer), collision_map, info.strength, info.decay, info.momentum,
+            info.collision_enabled != 0);
+    inf->assign_influence(get_layer_values(layer));
+    if (header.version >= 2) {
+        std::array<float, 9> weights;
+        std::copy(info.stencil_weights, info.stencil_weights + 9, weights.begin());
+        inf->set_stencil(static_cast<Stencil>(info.stencil), static_cast<CombineRule>(info.combine_rule));
+        inf->set_stencil_weights(weights);
+    }
+    const float* terrain_costs = get_layer_terrain_costs(layer);
+    if (terrain_costs != nullptr) {
+        for (int c = 0; c < TERRAIN_CLASSES; ++c) {
+            inf->set_terrain_cost(static_cast<std::uint8_t>(c), terrain_costs[c]);
+        }
+    }
+
+    // add_influence would fold a second source on a tile into the first, so those are added by handle
+    const FileSource* sources = get_layer_sources(layer);
+    std::vector<std::uint8_t> taken(static_cast<std::size_t>(header.width) * header.height, 0);
+    for (std::uint64_t i = 0; i < info.source_count; ++i) {
+        std::uint8_t& tile = taken[static_cast<std::size_t>(header.width) * sources[i].y + sources[i].x];
+        if (tile == 0) {
+            inf->add_influence(sources[i].x, sources[i].y, sources[i].strength);
+            tile = 1;
+        }
+        else {
+            inf->add_source(sources[i].x, sources[i].y, sources[i].strength);
+        }
+    }
+    return inf;
+}
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include <influence_layers.hpp>
+
+namespace {
+
+// narrowest vector width that holds layer_count lanes, whole widest vectors past that
+int padded_stride(int layer_count) {
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        if (layer_count <= get_simd_width(level)) {
+            return get_simd_width(level);
+        }
+    }
+    return (layer_count + LAYER_LANE_ALIGNMENT - 1) / LAYER_LANE_ALIGNMENT * LAYER_LANE_ALIGNMENT;
+}
+
+// highest level up to the selected one whose vectors divide the stride
+SimdLevel layer_simd_level(int stride) {
+    SimdLevel level = get_simd_level();
+    while (level != SimdLevel::SCALAR && stride % get_simd_width(level) != 0) {
+        level = static_cast<SimdLevel>(static_cast<int>(level) - 1);
+    }
+    return level;
+}
+
+}
+
+InfluenceLayers::InfluenceLayers(std::shared_ptr<CollisionMap> collision_map, bool collision_enabled) :
+    collision_map(collision_map),
+    collision_enabled(collision_enabled),
+    width(collision_map->get_width()),
+    height(collision_map->get_height()),
+    stride(0),
+    step_kernel(nullptr) {}
+
+int InfluenceLayers::add_layer(std::string name, float strength, float decay, float momentum) {
+    layers.push_back({name, strength, decay, momentum, {}});
+    int layer_count = static_cast<int>(layers.size());
+
+    // repack into a wider stride once the padding lanes run out
+    if (layer_count > stride) {
+        int new_stride = padded_stride(layer_count);
+        std::vector<float> repacked(static_cast<std::size_t>(width) * height * new_stride, 0.0f);
+        for (std::size_t i = 0; stride > 0 && i < static_cast<std::size_t>(width) * height; ++i) {
+            std::copy_n(&values[i * stride], stride, &repacked[i * new_stride]);
+        }
+
+        stride = new_stride;
+        values.swap(repacked);
+        buffer.assign(values.size(), 0.0f);
+        border_row.assign(static_cast<std::size_t>(width) * stride, 0.0f);
+    }
+
+    update_lanes();
+    return layer_count - 1;
+}
+
+SourceHandle InfluenceLayers::add_source(int layer, int tile_x, int tile_y, float source_strength) {
+    if (!on_map(tile_x, tile_y)) {
+        return {};
+    }
+    return layers[layer].sources.add(tile_x, tile_y, source_strength);
+}
+
+SourceHandle InfluenceLayers::add_source(int layer, int tile_x, int tile_y) {
+    return add_source(layer, tile_x, tile_y, layers[layer].strength);
+}
+
+bool InfluenceLayers::remove_source(int layer, SourceHandle handle) {
+    return layers[layer].sources.remove(handle);
+}
+
+bool InfluenceLayers::move_source(int layer, SourceHandle handle, int tile_x, int tile_y) {
+    InfluenceSource* src = layers[layer].sources.get(handle);
+    if (src == nullptr || !on_map(tile_x, tile_y)) {
+        return false;
+    }
+
+    src->x = tile_x;
+    src->y = tile_y;
+    return true;
+}
+
+void InfluenceLayers::clear_sources(int layer) {
+    layers[layer].sources.clear();
+}
+
+void InfluenceLayers::set_decay(int layer, float decay) {
+    layers[layer].decay = decay;
+    update_lanes();
+}
+
+void InfluenceLayers::set_momentum(int layer, float momentum) {
+    layers[layer].momentum = momentum;
+    update_lanes();
+}
+
+void InfluenceLayers::recalculate(ThreadPool* pool) {
+    if (layers.empty()) {
+        return;
+    }
+
+    for (int layer = 0; layer < get_layer_count(); ++layer) {
+        for (const auto& src : layers[layer].sources.get_sources()) {
+            values[(static_cast<std::size_t>(width) * src.y + src.x) * stride + layer] = src.strength;
+        }
+    }
+
+    step_kernel = get_propagate_layers_row(layer_simd_level(stride));
+
+    if (pool != nullptr && pool->get_concurrency() > 1) {
+        // bands on collision block boundaries, like recalculate_parallel does for single maps
+        int band = std::max(height / (pool->get_concurrency() * 4), 1);
+        band = (band + CollisionMap::BLOCK_SIZE - 1) / CollisionMap::BLOCK_SIZE * CollisionMap::BLOCK_SIZE;
+
+        std::vector<std::function<void()>> tasks;
+        for (int first = 0; first < height; first += band) {
+            int last = std::min(first + band, height);
+            tasks.push_back([this, first, last]() { recalculate_rows(first, last); });
+        }
+        pool->run(tasks);
+    }
+    else {
+        recalculate_rows(0, height);
+    }
+
+    values.swap(buffer);
+}
+
+void InfluenceLayers::recalculate_rows(int first, int last) {
+    std::size_t row_floats = static_cast<std::size_t>(width) * stride;
+
+    for (int y = first; y < last; ++y) {
+        const float* mid = &values[row_floats * y];
+        const float* up = y > 0 ? mid - row_floats : border_row.data();
+        const float* down = y < height - 1 ? mid + row_floats : border_row.data();
+        const std::uint64_t* blocked = collision_enabled ? collision_map->get_row_words(y) : nullptr;
+
+        step_kernel(up, mid, down, blocked, &buffer[row_floats * y], 0, width, width, stride,
+                lane_coefficients.data(), lane_momentums.data());
+    }
+}
+
+float InfluenceLayers::get_influence(int layer, int tile_x, int tile_y) const {
+    if (!on_map(tile_x, tile_y)) {
+        return 0.0f;
+    }
+    return values[(static_cast<std::size_t>(width) * tile_y + tile_x) * stride + layer];
+}
+
+void InfluenceLayers::copy_layer(int layer, std::vector<float>& out) const {
+    out.resize(static_cast<std::size_t>(width) * height);
+    for (std::size_t i = 0; i < out.size(); ++i) {
+        out[i] = values[i * stride + layer];
+    }
+}
+
+void InfluenceLayers::update_lanes() {
+    lane_coefficients.assign(stride, 0.0f);
+    lane_momentums.assign(stride, 0.0f);
+
+    // same coefficient expression as InfluenceMap so the layers match separate maps bit for bit
+    for (int layer = 0; layer < get_layer_count(); ++layer) {
+        lane_coefficients[layer] = expf(-1.0 * layers[layer].decay);
+        lane_momentums[layer] = layers[layer].momentum;
+    }
+}
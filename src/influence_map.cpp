@@ -1,10 +1,10 @@
 #include <algorithm>
 #include <cmath>
-#include <iostream>
-#include <allegro5/allegro.h>
-#include <allegro5/allegro_primitives.h>
+#include <limits>
 
 #include <influence_map.hpp>
+#include <propagation_kernel.hpp>
+#include <state_hash.hpp>
 
 InfluenceMap::InfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, float strength, float decay, float momentum, bool collision_enabled) :
     name(name),
@@ -14,80 +14,713 @@ InfluenceMap::InfluenceMap(std::string name, std::shared_ptr<CollisionMap> colli
     momentum(momentum),
     collision_enabled(collision_enabled),
     influence_map(collision_map->get_width() * collision_map->get_height(), 0.0f),
-    influence_buffer(collision_map->get_width() * collision_map->get_height(), 0.0f) {}
+    influence_buffer(collision_map->get_width() * collision_map->get_height(), 0.0f),
+    border_row(collision_map->get_width(), 0.0f),
+    generation(0),
+    step_coefficient(0.0f),
+    step_kernel(nullptr),
+    stencil(Stencil::FOUR),
+    combine_rule(CombineRule::MAX_ABS),
+    stencil_weights({1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f}),
+    step_coefficients(),
+    step_stencil_kernel(nullptr),
+    step_terrain(false),
+    incremental(false),
+    epsilon(1e-4f),
+    blocks_x(collision_map->get_blocks_x()),
+    blocks_y(collision_map->get_blocks_y()),
+    active_block_count(blocks_x * blocks_y),
+    collision_revision(collision_map->get_revision()),
+    block_countdown(blocks_x * blocks_y, 0),
+    block_active(blocks_x * blocks_y, 1),
+    block_row_active(blocks_y, 1),
+    block_has_source(blocks_x * blocks_y, 0),
+    block_deltas(blocks_x * blocks_y, 0.0f),
+    block_generations(blocks_x * blocks_y, 0),
+    front_buffer(0),
+    block_hashes({std::vector<std::uint64_t>(blocks_x * blocks_y, 0), std::vector<std::uint64_t>(blocks_x * blocks_y, 0)}),
+    block_hash_dirty({std::vector<std::uint8_t>(blocks_x * blocks_y, 1), std::vector<std::uint8_t>(blocks_x * blocks_y, 1)}),
+    state_hashes({0, 0}) {
+    terrain_costs.fill(1.0f);
+    terrain_coefficients.fill(1.0f);
+}
 
-void InfluenceMap::add_influence(int tile_x, int tile_y) {
-    if (tile_x >= 0 && tile_y >= 0 && tile_x < collision_map->get_width() && tile_y < collision_map->get_height()) {
-        auto itr = std::find_if(influence_sources.begin(), influence_sources.end(), [&](const InfluenceSource& s) { return s.x == tile_x && s.y == tile_y; });
-        if (itr == influence_sources.end()) {
-            InfluenceSource src = {tile_x, tile_y};
-            influence_sources.push_back(src);
-        }
+SourceHandle InfluenceMap::add_influence(int tile_x, int tile_y) {
+    return add_influence(tile_x, tile_y, strength);
+}
+
+SourceHandle InfluenceMap::add_influence(int tile_x, int tile_y, float source_strength) {
+    if (!on_map(tile_x, tile_y)) {
+        return {};
     }
+
+    auto itr = tile_sources.find(collision_map->get_width() * tile_y + tile_x);
+    if (itr != tile_sources.end()) {
+        set_source_strength(itr->second, source_strength);
+        return itr->second;
+    }
+
+    SourceHandle handle = add_source(tile_x, tile_y, source_strength);
+    tile_sources[collision_map->get_width() * tile_y + tile_x] = handle;
+    return handle;
 }
 
 void InfluenceMap::remove_influence(int tile_x, int tile_y) {
-    if (tile_x >= 0 && tile_y >= 0 && tile_x < collision_map->get_width() && tile_y < collision_map->get_height()) {
-        std::erase_if(influence_sources, [&](const InfluenceSource& s) { return s.x == tile_x && s.y == tile_y; });
+    if (on_map(tile_x, tile_y)) {
+        auto itr = tile_sources.find(collision_map->get_width() * tile_y + tile_x);
+        if (itr != tile_sources.end()) {
+            remove_source(itr->second);
+        }
     }
 }
 
-void InfluenceMap::recalculate() {
+SourceHandle InfluenceMap::add_source(int tile_x, int tile_y, float source_strength) {
+    if (!on_map(tile_x, tile_y)) {
+        return {};
+    }
+
+    wake_tile(tile_x, tile_y);
+    return influence_sources.add(tile_x, tile_y, source_strength);
+}
+
+bool InfluenceMap::remove_source(SourceHandle handle) {
+    const InfluenceSource* src = influence_sources.get(handle);
+    if (src == nullptr) {
+        return false;
+    }
+
+    wake_tile(src->x, src->y);
+    forget_tile_source(handle, *src);
+    return influence_sources.remove(handle);
+}
+
+bool InfluenceMap::move_source(SourceHandle handle, int tile_x, int tile_y) {
+    InfluenceSource* src = influence_sources.get(handle);
+    if (src == nullptr || !on_map(tile_x, tile_y)) {
+        return false;
+    }
+
+    if (src->x != tile_x || src->y != tile_y) {
+        // a source created by add_influence takes its tile entry along, unless the new tile already has one
+        bool owned_tile = forget_tile_source(handle, *src);
+        wake_tile(src->x, src->y);
+        wake_tile(tile_x, tile_y);
+        src->x = tile_x;
+        src->y = tile_y;
+        if (owned_tile) {
+            tile_sources.emplace(collision_map->get_width() * tile_y + tile_x, handle);
+        }
+    }
+    return true;
+}
+
+bool InfluenceMap::set_source_strength(SourceHandle handle, float source_strength) {
+    InfluenceSource* src = influence_sources.get(handle);
+    if (src == nullptr) {
+        return false;
+    }
+
+    if (src->strength != source_strength) {
+        src->strength = source_strength;
+        wake_tile(src->x, src->y);
+    }
+    return true;
+}
+
+void InfluenceMap::move_sources(const std::vector<SourceMove>& moves) {
+    for (const auto& move : moves) {
+        move_source(move.handle, move.tile_x, move.tile_y);
+    }
+}
+
+void InfluenceMap::clear_sources() {
+    for (const auto& src : influence_sources.get_sources()) {
+        wake_tile(src.x, src.y);
+    }
+
+    influence_sources.clear();
+    tile_sources.clear();
+}
+
+bool InfluenceMap::on_map(int tile_x, int tile_y) {
+    return tile_x >= 0 && tile_y >= 0 && tile_x < collision_map->get_width() && tile_y < collision_map->get_height();
+}
+
+bool InfluenceMap::forget_tile_source(SourceHandle handle, const InfluenceSource& src) {
+    auto itr = tile_sources.find(collision_map->get_width() * src.y + src.x);
+    if (itr != tile_sources.end() && itr->second == handle) {
+        tile_sources.erase(itr);
+        return true;
+    }
+    return false;
+}
+
+void InfluenceMap::set_collision(bool enabled) {
+    if (collision_enabled != enabled) {
+        collision_enabled = enabled;
+        wake_all();
+    }
+}
+
+void InfluenceMap::set_influence(int tile_x, int tile_y, float value) {
+    if (on_map(tile_x, tile_y)) {
+        int width = collision_map->get_width();
+        influence_map[width * tile_y + tile_x] = value;
+        influence_buffer[width * tile_y + tile_x] = value;
+        wake_tile(tile_x, tile_y);
+        for (auto& dirty : block_hash_dirty) {
+            dirty[blocks_x * (tile_y / CollisionMap::BLOCK_SIZE) + tile_x / CollisionMap::BLOCK_SIZE] = 1;
+        }
+        ++generation;
+        touch_block(tile_x / CollisionMap::BLOCK_SIZE, tile_y / CollisionMap::BLOCK_SIZE);
+    }
+}
+
+void InfluenceMap::assign_influence(const float* values) {
+    std::copy_n(values, influence_map.size(), influence_map.begin());
+    std::copy_n(values, influence_buffer.size(), influence_buffer.begin());
+    wake_all();
+    invalidate_hashes();
+    ++generation;
+    std::fill(block_generations.begin(), block_generations.end(), generation);
+}
+
+void InfluenceMap::set_stencil(Stencil stencil, CombineRule rule) {
+    this->stencil = stencil;
+    this->combine_rule = rule;
+    wake_all();
+}
+
+void InfluenceMap::set_stencil_weights(const std::array<float, 9>& weights) {
+    stencil_weights = weights;
+    wake_all();
+}
+
+void InfluenceMap::set_terrain_cost(std::uint8_t terrain_class, float cost) {
+    terrain_costs[terrain_class] = std::max(cost, 0.0f);
+    // the stencil coefficients already hold one unit of decay
+    terrain_coefficients[terrain_class] = expf(-decay * (terrain_costs[terrain_class] - 1.0f));
+    wake_all();
+}
+
+void InfluenceMap::set_incremental(bool enabled, float epsilon) {
+    this->incremental = enabled;
+    this->epsilon = epsilon;
+    collision_revision = collision_map->get_revision();
+
+    // start from a full pass, the buffers may not agree yet
+    wake_all();
+}
+
+void InfluenceMap::wake_block(int block_x, int block_y) {
+    for (int by = std::max(block_y - 1, 0); by <= std::min(block_y + 1, blocks_y - 1); ++by) {
+        for (int bx = std::max(block_x - 1, 0); bx <= std::min(block_x + 1, blocks_x - 1); ++bx) {
+            // two steps so both buffers receive the change before the block can sleep again
+            block_countdown[blocks_x * by + bx] = 2;
+        }
+    }
+}
+
+void InfluenceMap::wake_tile(int tile_x, int tile_y) {
+    wake_block(tile_x / CollisionMap::BLOCK_SIZE, tile_y / CollisionMap::BLOCK_SIZE);
+}
+
+void InfluenceMap::wake_all() {
+    std::fill(block_countdown.begin(), block_countdown.end(), 2);
+}
+
+float InfluenceMap::block_delta(int block_x, int block_y) const {
+    int width = collision_map->get_width();
+    int x0 = block_x * CollisionMap::BLOCK_SIZE;
+    int y0 = block_y * CollisionMap::BLOCK_SIZE;
+    int x1 = std::min(x0 + CollisionMap::BLOCK_SIZE, width);
+    int y1 = std::min(y0 + CollisionMap::BLOCK_SIZE, collision_map->get_height());
+    float delta = 0.0f;
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            delta = std::max(delta, std::abs(influence_buffer[width * y + x] - influence_map[width * y + x]));
+        }
+    }
+
+    return delta;
+}
+
+void InfluenceMap::solve_steady_state() {
+    std::vector<float> positive, negative;
+    solve_distances(true, positive);
+    solve_distances(false, negative);
+
+    // the stronger side wins, ties go to the positive side like in the kernel
+    for (std::size_t i = 0; i < influence_map.size(); ++i) {
+        influence_map[i] = negative[i] > positive[i] ? -negative[i] : positive[i];
+    }
+    influence_buffer = influence_map;
+    invalidate_hashes();
+    ++generation;
+    std::fill(block_generations.begin(), block_generations.end(), generation);
+}
+
+void InfluenceMap::invalidate_hashes() {
+    for (auto& dirty : block_hash_dirty) {
+        std::fill(dirty.begin(), dirty.end(), 1);
+    }
+}
+
+void InfluenceMap::touch_block(int block_x, int block_y) {
+    block_generations[blocks_x * block_y + block_x] = generation;
+}
+
+void InfluenceMap::copy_block_to_back(int block_x, int block_y) {
+    int width = collision_map->get_width();
+    int x0 = block_x * CollisionMap::BLOCK_SIZE;
+    int y0 = block_y * CollisionMap::BLOCK_SIZE;
+    int x1 = std::min(x0 + CollisionMap::BLOCK_SIZE, width);
+    int y1 = std::min(y0 + CollisionMap::BLOCK_SIZE, collision_map->get_height());
+
+    for (int y = y0; y < y1; ++y) {
+        std::copy(&influence_map[width * y + x0], &influence_map[width * y + x1], &influence_buffer[width * y + x0]);
+    }
+    block_hash_dirty[front_buffer ^ 1][blocks_x * block_y + block_x] = 1;
+}
+
+std::uint64_t InfluenceMap::get_state_hash() {
     int width = collision_map->get_width();
     int height = collision_map->get_height();
-    const auto& blocked_map = collision_map->get_collision_map();
+    std::vector<std::uint64_t>& hashes = block_hashes[front_buffer];
+    std::vector<std::uint8_t>& dirty = block_hash_dirty[front_buffer];
+    std::uint64_t& state_hash = state_hashes[front_buffer];
 
-    for (const auto& src : influence_sources) {
-        // first setup the sources of influence
-        influence_buffer[width * src.y + src.x] = strength;
+    // the state hash is the xor of the block hashes, so a block is swapped out and back in
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            int b = blocks_x * by + bx;
+            if (dirty[b]) {
+                state_hash ^= hashes[b];
+                hashes[b] = hash_grid_block(influence_map.data(), width, height, bx, by);
+                state_hash ^= hashes[b];
+                dirty[b] = 0;
+            }
+        }
     }
 
-    // not dealing with diagonal influence, so the distance is always 1.0
-    float coefficient = expf(-1.0 * decay);
+    return state_hash;
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            if (collision_enabled && blocked_map[width * y + x]) {
-                // skip blocked tiles and reset influence to zero
-                influence_buffer[width * y + x] = 0.0f;
-                continue;
+void InfluenceMap::solve_distances(bool positive, std::vector<float>& values) {
+    int width = collision_map->get_width();
+    int height = collision_map->get_height();
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    // a weaker source behaves like a stronger one that is ln(strongest / weaker) / decay tiles further away,
+    // so every source becomes a seed with a starting distance and one distance field covers all of them
+    struct Seed {
+        float distance;
+        int tile;
+    };
+
+    // the iterated map restamps every source tile each step, so a source tile holds its own strength whatever
+    // reaches it from outside and nothing passes through it, with several sources on a tile the last one wins
+    std::vector<int> stamp_index(influence_map.size(), -1);
+    std::vector<std::pair<int, float>> stamps;
+    for (const auto& src : influence_sources.get_sources()) {
+        int tile = width * src.y + src.x;
+        if (stamp_index[tile] < 0) {
+            stamp_index[tile] = static_cast<int>(stamps.size());
+            stamps.push_back({tile, src.strength});
+        }
+        else {
+            stamps[stamp_index[tile]].second = src.strength;
+        }
+    }
+
+    float max_strength = 0.0f;
+    for (const auto& stamp : stamps) {
+        if ((stamp.second > 0.0f) == positive && stamp.second != 0.0f) {
+            max_strength = std::max(max_strength, std::abs(stamp.second));
+        }
+    }
+
+    values.assign(influence_map.size(), 0.0f);
+    if (max_strength == 0.0f) {
+        return;
+    }
+
+    float safe_decay = std::max(decay, 1e-6f);
+    std::vector<Seed> seeds;
+    for (const auto& stamp : stamps) {
+        if ((stamp.second > 0.0f) == positive && stamp.second != 0.0f) {
+            float offset = std::log(max_strength / std::abs(stamp.second)) / safe_decay;
+            seeds.push_back({offset, stamp.first});
+        }
+    }
+    std::sort(seeds.begin(), seeds.end(), [](const Seed& a, const Seed& b) { return a.distance < b.distance; });
+
+    // entering a tile costs its terrain cost on top of the step, minus the 1.0 of open ground
+    bool terrain = collision_map->has_terrain();
+    float max_cost = 1.0f;
+    if (terrain) {
+        max_cost = *std::max_element(terrain_costs.begin(), terrain_costs.end());
+    }
+    auto extra_cost = [&](int x, int y) {
+        return terrain ? terrain_costs[collision_map->get_terrain_row(y)[x]] - 1.0f : 0.0f;
+    };
+
+    // Dial's algorithm: tiles are grouped in buckets one unit of distance wide and the buckets are kept in a
+    // ring long enough for the longest step, so a bucket only feeds itself (steps below one unit on cheap
+    // terrain) or one of the buckets ahead of it that are still in the ring
+    bool diagonals = stencil != Stencil::FOUR;
+    const float diagonal_step = 1.41421356f;
+    float max_step = (diagonals ? diagonal_step : 1.0f) + max_cost - 1.0f;
+    int ring_size = static_cast<int>(std::floor(max_step)) + 2;
+
+    std::vector<float> distances(influence_map.size(), infinity);
+    std::vector<std::vector<int>> ring(ring_size);
+    std::size_t queued = 0;
+    std::size_t next_seed = 0;
+    double bucket = std::floor(seeds[0].distance);
+
+    auto walkable = [&](int x, int y) {
+        return !collision_enabled || ((collision_map->get_row_words(y)[x >> 6] >> (x & 63)) & 1) == 0;
+    };
+    auto bucket_of = [&](double distance) -> std::vector<int>& {
+        return ring[static_cast<std::size_t>(static_cast<long long>(std::floor(distance)) % ring_size)];
+    };
+
+    while (next_seed < seeds.size() || queued > 0) {
+        if (queued == 0 && std::floor(seeds[next_seed].distance) > bucket) {
+            bucket = std::floor(seeds[next_seed].distance);
+        }
+
+        std::vector<int>& current = bucket_of(bucket);
+        for (; next_seed < seeds.size() && std::floor(seeds[next_seed].distance) <= bucket; ++next_seed) {
+            const Seed& seed = seeds[next_seed];
+            if (seed.distance < distances[seed.tile]) {
+                distances[seed.tile] = seed.distance;
+                current.push_back(seed.tile);
+                ++queued;
             }
+        }
+
+        // current can grow while it is walked, so it is indexed instead of iterated
+        for (std::size_t i = 0; i < current.size(); ++i) {
+            int tile = current[i];
+            int x = tile % width;
+            int y = tile / width;
 
-            float max_influence = 0.0f;
-            float min_influence = 0.0f;
+            auto relax = [&](int nx, int ny, float step) {
+                int neighbor = width * ny + nx;
+                float distance = distances[tile] + step + extra_cost(nx, ny);
+                if (distance < distances[neighbor] && stamp_index[neighbor] < 0 && walkable(nx, ny)) {
+                    distances[neighbor] = distance;
+                    bucket_of(distance).push_back(neighbor);
+                    ++queued;
+                }
+            };
 
-            // discover neighboring influences
             if (y > 0) {
-                float tmp_influence = influence_buffer[width * (y - 1) + x] * coefficient;
-                max_influence = std::max(tmp_influence, max_influence);
-                min_influence = std::min(tmp_influence, min_influence);
+                relax(x, y - 1, 1.0f);
             }
             if (y < height - 1) {
-                float tmp_influence = influence_buffer[width * (y + 1) + x] * coefficient;
-                max_influence = std::max(tmp_influence, max_influence);
-                min_influence = std::min(tmp_influence, min_influence);
+                relax(x, y + 1, 1.0f);
             }
             if (x > 0) {
-                float tmp_influence = influence_buffer[width * y + (x - 1)] * coefficient;
-                max_influence = std::max(tmp_influence, max_influence);
-                min_influence = std::min(tmp_influence, min_influence);
+                relax(x - 1, y, 1.0f);
             }
             if (x < width - 1) {
-                float tmp_influence = influence_buffer[width * y + (x + 1)] * coefficient;
-                max_influence = std::max(tmp_influence, max_influence);
-                min_influence = std::min(tmp_influence, min_influence);
+                relax(x + 1, y, 1.0f);
             }
 
-            // linearly interpolate the influence based on the strongest neighbor and momentum (positive or negative)
-            if (std::abs(min_influence) > max_influence) {
-                influence_map[width * y + x] = std::lerp(influence_buffer[width * y + x], min_influence, momentum);
+            if (diagonals) {
+                for (int dy = -1; dy <= 1; dy += 2) {
+                    for (int dx = -1; dx <= 1; dx += 2) {
+                        if (x + dx >= 0 && x + dx < width && y + dy >= 0 && y + dy < height) {
+                            relax(x + dx, y + dy, diagonal_step);
+                        }
+                    }
+                }
             }
-            else {
-                influence_map[width * y + x] = std::lerp(influence_buffer[width * y + x], max_influence, momentum);
+        }
+
+        queued -= current.size();
+        current.clear();
+        bucket += 1.0;
+    }
+
+    for (std::size_t i = 0; i < distances.size(); ++i) {
+        int x = static_cast<int>(i % width);
+        int y = static_cast<int>(i / width);
+        if (distances[i] != infinity && walkable(x, y)) {
+            values[i] = max_strength * std::exp(-safe_decay * distances[i]);
+        }
+    }
+}
+
+void InfluenceMap::recalculate() {
+    begin_recalculate();
+    recalculate_rows(0, collision_map->get_height());
+    end_recalculate();
+}
+
+void InfluenceMap::begin_recalculate() {
+    INFLUENCE_PROFILE_SCOPE(profile, ProfilePhase::STAMP, "stamp", name);
+    int width = collision_map->get_width();
+
+    if (incremental) {
+        // wake blocks whose walls changed since the last step
+        if (collision_map->get_revision() != collision_revision) {
+            for (int by = 0; by < blocks_y; ++by) {
+                for (int bx = 0; bx < blocks_x; ++bx) {
+                    if (collision_map->get_block_revision(bx, by) > collision_revision) {
+                        wake_block(bx, by);
+                    }
+                }
             }
+            collision_revision = collision_map->get_revision();
+        }
+
+        // blocks holding a source never sleep, the stamp is rewritten every step
+        std::fill(block_has_source.begin(), block_has_source.end(), 0);
+        stamped_values.clear();
+        for (const auto& src : influence_sources.get_sources()) {
+            block_has_source[blocks_x * (src.y / CollisionMap::BLOCK_SIZE) + src.x / CollisionMap::BLOCK_SIZE] = 1;
+            stamped_values.push_back(influence_map[width * src.y + src.x]);
+        }
+
+        active_block_count = 0;
+        std::fill(block_row_active.begin(), block_row_active.end(), 0);
+        for (std::size_t b = 0; b < block_active.size(); ++b) {
+            block_active[b] = block_countdown[b] > 0 || block_has_source[b];
+            block_deltas[b] = 0.0f;
+            block_row_active[b / blocks_x] |= block_active[b];
+            active_block_count += block_active[b];
         }
     }
 
-    // now apply changes to the buffer for the next calculation
-    influence_buffer = influence_map;
-}
\ No newline at end of file
+    // first setup the sources of influence, the front buffer is what this step reads from
+    for (const auto& src : influence_sources.get_sources()) {
+        influence_map[width * src.y + src.x] = src.strength;
+        block_hash_dirty[front_buffer][blocks_x * (src.y / CollisionMap::BLOCK_SIZE) + src.x / CollisionMap::BLOCK_SIZE] = 1;
+    }
+    // the stamps are visible through get_influence_map() until the swap, results cached before them are stale
+    if (!influence_sources.get_sources().empty()) {
+        ++generation;
+        for (const auto& src : influence_sources.get_sources()) {
+            touch_block(src.x / CollisionMap::BLOCK_SIZE, src.y / CollisionMap::BLOCK_SIZE);
+        }
+    }
+    INFLUENCE_PROFILE(profile.add_sources_stamped(influence_sources.get_sources().size()));
+
+    // the plain 4 neighbor stencil keeps its own kernel, the distance to every neighbor is 1.0
+    step_coefficient = expf(-1.0 * decay);
+    step_kernel = get_propagate_row(get_simd_level());
+    step_stencil_kernel = nullptr;
+    step_terrain = collision_map->has_terrain();
+
+    // terrain is only handled by the stencil kernels, FOUR with MAX_ABS gives the same result as the default one
+    if (stencil != Stencil::FOUR || combine_rule != CombineRule::MAX_ABS || step_terrain) {
+        update_stencil_coefficients();
+        step_stencil_kernel = get_propagate_stencil_row(get_simd_level(), stencil, combine_rule, step_terrain);
+    }
+}
+
+void InfluenceMap::update_stencil_coefficients() {
+    // kernel neighbor order (up, down, left, right, up left, up right, down left, down right) in the 3x3 grid
+    const int weight_index[STENCIL_NEIGHBORS] = {1, 7, 3, 5, 0, 2, 6, 8};
+    float diagonal = stencil == Stencil::EIGHT ? expf(-1.41421356f * decay) : 0.0f;
+    float total_weight = 0.0f;
+
+    // an edge that passes on more than it takes in makes the maximum rules grow without bound around any loop,
+    // so weights are capped where the cheapest terrain times the weight carries influence without loss
+    float max_terrain_coefficient = step_terrain ? *std::max_element(terrain_coefficients.begin(), terrain_coefficients.end()) : 1.0f;
+    float max_weight = 1.0f / (step_coefficient * max_terrain_coefficient);
+
+    for (int i = 0; i < STENCIL_NEIGHBORS; ++i) {
+        float weight = 1.0f;
+        if (stencil == Stencil::WEIGHTED) {
+            weight = std::clamp(stencil_weights[weight_index[i]], 0.0f, max_weight);
+            step_coefficients[i] = step_coefficient * weight;
+        }
+        else if (i < 4) {
+            step_coefficients[i] = step_coefficient;
+        }
+        else {
+            weight = stencil == Stencil::EIGHT ? 1.0f : 0.0f;
+            step_coefficients[i] = diagonal;
+        }
+        total_weight += weight;
+    }
+
+    // the average divides by the total weight, folding it into the coefficients saves the division per tile
+    if (combine_rule == CombineRule::AVERAGE && total_weight > 0.0f) {
+        for (float& coefficient : step_coefficients) {
+            coefficient /= total_weight;
+        }
+    }
+}
+
+void InfluenceMap::propagate_span(const float* up, const float* mid, const float* down, const std::uint64_t* blocked,
+        const std::uint8_t* terrain, float* out, int first, int last, int width) {
+    if (step_stencil_kernel != nullptr) {
+        step_stencil_kernel(up, mid, down, blocked, terrain, terrain_coefficients.data(), out, first, last, width,
+                step_coefficients.data(), momentum);
+    }
+    else {
+        step_kernel(up, mid, down, blocked, out, first, last, width, step_coefficient, momentum);
+    }
+}
+
+void InfluenceMap::recalculate_rows(int first_row, int last_row) {
+    propagate_rows(first_row, last_row);
+    // the extra pass over the rows is not part of the propagate time it would otherwise inflate
+    INFLUENCE_PROFILE(count_changed_rows(first_row, last_row));
+}
+
+void InfluenceMap::propagate_rows(int first_row, int last_row) {
+    INFLUENCE_PROFILE_SCOPE(profile, ProfilePhase::PROPAGATE, "propagate", name);
+    int width = collision_map->get_width();
+    int height = collision_map->get_height();
+
+    for (int y = std::max(first_row, 0); y < std::min(last_row, height); ++y) {
+        // rows outside the grid read as zero influence
+        const float* up = y > 0 ? &influence_map[width * (y - 1)] : border_row.data();
+        const float* down = y < height - 1 ? &influence_map[width * (y + 1)] : border_row.data();
+        const std::uint64_t* blocked = collision_enabled ? collision_map->get_row_words(y) : nullptr;
+        const std::uint8_t* terrain = step_terrain ? collision_map->get_terrain_row(y) : nullptr;
+
+        const float* mid = &influence_map[width * y];
+        float* out = &influence_buffer[width * y];
+
+        // blocked tiles are reset to zero influence
+        if (!incremental) {
+            propagate_span(up, mid, down, blocked, terrain, out, 0, width, width);
+            continue;
+        }
+        else if (!block_row_active[y / CollisionMap::BLOCK_SIZE]) {
+            continue;
+        }
+
+        // run the kernel once per span of consecutive active blocks and track how far each block moved
+        int block_row = blocks_x * (y / CollisionMap::BLOCK_SIZE);
+        for (int bx = 0; bx < blocks_x;) {
+            if (!block_active[block_row + bx]) {
+                ++bx;
+                continue;
+            }
+
+            int span_start = bx;
+            while (bx < blocks_x && block_active[block_row + bx]) {
+                ++bx;
+            }
+
+            int first = span_start * CollisionMap::BLOCK_SIZE;
+            int last = std::min(bx * CollisionMap::BLOCK_SIZE, width);
+            propagate_span(up, mid, down, blocked, terrain, out, first, last, width);
+
+            for (int b = span_start; b < bx; ++b) {
+                float delta = block_deltas[block_row + b];
+                int x1 = std::min((b + 1) * CollisionMap::BLOCK_SIZE, width);
+                for (int x = b * CollisionMap::BLOCK_SIZE; x < x1; ++x) {
+                    delta = std::max(delta, std::abs(out[x] - mid[x]));
+                }
+                block_deltas[block_row + b] = delta;
+            }
+        }
+    }
+}
+
+#ifdef INFLUENCE_PROFILING
+void InfluenceMap::count_changed_rows(int first_row, int last_row) {
+    int width = collision_map->get_width();
+    int height = collision_map->get_height();
+
+    for (int y = std::max(first_row, 0); y < std::min(last_row, height); ++y) {
+        const float* mid = &influence_map[width * y];
+        const float* out = &influence_buffer[width * y];
+        if (!incremental) {
+            profile.add_tiles(width, count_changed_tiles(mid, out, 0, width));
+            continue;
+        }
+
+        // only the active blocks were written, the others hold what the back buffer had
+        int block_row = blocks_x * (y / CollisionMap::BLOCK_SIZE);
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            if (block_active[block_row + bx]) {
+                int first = bx * CollisionMap::BLOCK_SIZE;
+                int last = std::min(first + CollisionMap::BLOCK_SIZE, width);
+                profile.add_tiles(last - first, count_changed_tiles(mid, out, first, last));
+            }
+        }
+    }
+}
+#endif
+
+void InfluenceMap::end_recalculate() {
+    INFLUENCE_PROFILE_SCOPE(profile, ProfilePhase::SWAP, "swap", name);
+    if (incremental) {
+        int width = collision_map->get_width();
+
+        // undo the stamps in reverse order so source blocks are measured against their last output
+        const auto& sources = influence_sources.get_sources();
+        for (std::size_t i = sources.size(); i-- > 0;) {
+            influence_map[width * sources[i].y + sources[i].x] = stamped_values[i];
+        }
+
+        for (int by = 0; by < blocks_y; ++by) {
+            for (int bx = 0; bx < blocks_x; ++bx) {
+                if (block_has_source[blocks_x * by + bx]) {
+                    block_deltas[blocks_x * by + bx] = block_delta(bx, by);
+                }
+            }
+        }
+    }
+
+    // blocks the step wrote have to be rehashed in the back buffer
+    std::vector<std::uint8_t>& back_dirty = block_hash_dirty[front_buffer ^ 1];
+    if (incremental) {
+        for (std::size_t b = 0; b < block_active.size(); ++b) {
+            back_dirty[b] |= block_active[b];
+        }
+    }
+    else {
+        std::fill(back_dirty.begin(), back_dirty.end(), 1);
+    }
+
+    // the back buffer now holds the new step, swapping only exchanges the pointers
+    influence_map.swap(influence_buffer);
+    front_buffer ^= 1;
+    ++generation;
+    INFLUENCE_PROFILE(profile.add_steps(1));
+
+    if (!incremental) {
+        std::fill(block_generations.begin(), block_generations.end(), generation);
+        return;
+    }
+
+    for (std::size_t b = 0; b < block_active.size(); ++b) {
+        if (block_active[b]) {
+            block_generations[b] = generation;
+            if (block_countdown[b] > 0) {
+                --block_countdown[b];
+            }
+        }
+    }
+
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            if (block_active[blocks_x * by + bx] && block_deltas[blocks_x * by + bx] > epsilon) {
+                wake_block(bx, by);
+            }
+        }
+    }
+
+    // blocks going to sleep keep the last step in both buffers, so later swaps leave their values alone
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            int b = blocks_x * by + bx;
+            if (block_active[b] && block_countdown[b] == 0 && !block_has_source[b]) {
+                copy_block_to_back(bx, by);
+            }
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <functional>
+
+#include <influence_query.hpp>
+
+namespace {
+
+struct SearchCell {
+    // bound on the cell's values, negated for lowest first searches so the heap always pops the largest key
+    float key;
+    int level, cell_x, cell_y;
+
+    // ties go to the finer cell so flat areas are walked depth first instead of opened level by level
+    bool operator<(const SearchCell& other) const { return key < other.key || (key == other.key && level > other.level); }
+};
+
+// queries per pool task in run_batch
+const int BATCH_TASK_SIZE = 64;
+
+}
+
+InfluenceQuery::InfluenceQuery(std::shared_ptr<InfluenceMap> map) :
+    map(map),
+    width(map->get_width()),
+    height(map->get_height()),
+    built(false),
+    built_generation(0),
+    sums(static_cast<std::size_t>(width + 1) * (height + 1), 0.0) {
+    // level 0 reads the map directly, only the coarser levels get storage
+    int level_width = width;
+    int level_height = height;
+    level_widths.push_back(level_width);
+    level_heights.push_back(level_height);
+    max_levels.emplace_back();
+    min_levels.emplace_back();
+
+    while (level_width > 1 || level_height > 1) {
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+        level_widths.push_back(level_width);
+        level_heights.push_back(level_height);
+        max_levels.emplace_back(static_cast<std::size_t>(level_width) * level_height, 0.0f);
+        min_levels.emplace_back(static_cast<std::size_t>(level_width) * level_height, 0.0f);
+    }
+
+    // level 1 has the most cells, the marks are shared by all levels
+    if (max_levels.size() > 1) {
+        cell_marks.assign(max_levels[1].size(), 0);
+    }
+}
+
+void InfluenceQuery::refresh() {
+    if (built && map->get_generation() == built_generation) {
+        return;
+    }
+
+    // blocks whose values changed since the last build, everything on the first build
+    dirty_blocks.clear();
+    int blocks_x = map->get_blocks_x();
+    int blocks_y = map->get_blocks_y();
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            if (!built || map->get_block_generation(bx, by) > built_generation) {
+                dirty_blocks.push_back(blocks_x * by + bx);
+            }
+        }
+    }
+
+    if (!dirty_blocks.empty()) {
+        // every row sum past the first changed row depends on it, the rows above keep their sums
+        int first_row = dirty_blocks[0] / blocks_x * CollisionMap::BLOCK_SIZE;
+        refresh_sums(first_row);
+
+        if (static_cast<int>(dirty_blocks.size()) == blocks_x * blocks_y) {
+            for (std::size_t level = 1; level < max_levels.size(); ++level) {
+                for (int cy = 0; cy < level_heights[level]; ++cy) {
+                    for (int cx = 0; cx < level_widths[level]; ++cx) {
+                        rebuild_cell(static_cast<int>(level), cx, cy);
+                    }
+                }
+            }
+        }
+        else {
+            refresh_dirty_cells();
+        }
+    }
+
+    built = true;
+    built_generation = map->get_generation();
+}
+
+void InfluenceQuery::refresh_sums(int first_row) {
+    const auto& values = map->get_influence_map();
+
+    // summed-area table, row by row with a running row sum
+    std::size_t stride = width + 1;
+    for (int y = first_row; y < height; ++y) {
+        double row_sum = 0.0;
+        for (int x = 0; x < width; ++x) {
+            row_sum += values[static_cast<std::size_t>(width) * y + x];
+            sums[stride * (y + 1) + x + 1] = sums[stride * y + x + 1] + row_sum;
+        }
+    }
+}
+
+void InfluenceQuery::refresh_dirty_cells() {
+    // the cells of every level above a dirty block, each rebuilt once per level from the level below
+    for (std::size_t level = 1; level < max_levels.size(); ++level) {
+        dirty_cells.clear();
+        for (int block : dirty_blocks) {
+            int x0 = block % map->get_blocks_x() * CollisionMap::BLOCK_SIZE;
+            int y0 = block / map->get_blocks_x() * CollisionMap::BLOCK_SIZE;
+            int x1 = std::min(x0 + CollisionMap::BLOCK_SIZE, width) - 1;
+            int y1 = std::min(y0 + CollisionMap::BLOCK_SIZE, height) - 1;
+
+            for (int cy = y0 >> level; cy <= y1 >> level; ++cy) {
+                for (int cx = x0 >> level; cx <= x1 >> level; ++cx) {
+                    std::size_t cell = static_cast<std::size_t>(level_widths[level]) * cy + cx;
+                    if (!cell_marks[cell]) {
+                        cell_marks[cell] = 1;
+                        dirty_cells.push_back(static_cast<int>(cell));
+                    }
+                }
+            }
+        }
+
+        for (int cell : dirty_cells) {
+            rebuild_cell(static_cast<int>(level), cell % level_widths[level], cell / level_widths[level]);
+            cell_marks[cell] = 0;
+        }
+    }
+}
+
+void InfluenceQuery::rebuild_cell(int level, int cell_x, int cell_y) {
+    // every pyramid cell holds the extremes of the up to four cells under it
+    int below_width = level_widths[level - 1];
+    int below_height = level_heights[level - 1];
+    const float* below_max = level == 1 ? map->get_influence_map().data() : max_levels[level - 1].data();
+    const float* below_min = level == 1 ? map->get_influence_map().data() : min_levels[level - 1].data();
+
+    int x0 = cell_x * 2, y0 = cell_y * 2;
+    int x1 = std::min(x0 + 1, below_width - 1);
+    int y1 = std::min(y0 + 1, below_height - 1);
+
+    float high = std::max(std::max(below_max[below_width * y0 + x0], below_max[below_width * y0 + x1]),
+            std::max(below_max[below_width * y1 + x0], below_max[below_width * y1 + x1]));
+    float low = std::min(std::min(below_min[below_width * y0 + x0], below_min[below_width * y0 + x1]),
+            std::min(below_min[below_width * y1 + x0], below_min[below_width * y1 + x1]));
+    max_levels[level][static_cast<std::size_t>(level_widths[level]) * cell_y + cell_x] = high;
+    min_levels[level][static_cast<std::size_t>(level_widths[level]) * cell_y + cell_x] = low;
+}
+
+double InfluenceQuery::area_sum(int tile_x, int tile_y, int rect_width, int rect_height) {
+    INFLUENCE_PROFILE_SCOPE(map->get_profile_counters(), ProfilePhase::QUERY, "query", map->get_name());
+    INFLUENCE_PROFILE(map->get_profile_counters().add_queries(1));
+    refresh();
+
+    Region region = rect_region(tile_x, tile_y, rect_width, rect_height);
+    if (region.x0 > region.x1 || region.y0 > region.y1) {
+        return 0.0;
+    }
+
+    std::size_t stride = width + 1;
+    return sums[stride * (region.y1 + 1) + region.x1 + 1] - sums[stride * region.y0 + region.x1 + 1]
+        - sums[stride * (region.y1 + 1) + region.x0] + sums[stride * region.y0 + region.x0];
+}
+
+float InfluenceQuery::area_mean(int tile_x, int tile_y, int rect_width, int rect_height) {
+    Region region = rect_region(tile_x, tile_y, rect_width, rect_height);
+    if (region.x0 > region.x1 || region.y0 > region.y1) {
+        return 0.0f;
+    }
+
+    double area = static_cast<double>(region.x1 - region.x0 + 1) * (region.y1 - region.y0 + 1);
+    return static_cast<float>(area_sum(tile_x, tile_y, rect_width, rect_height) / area);
+}
+
+QueryResult InfluenceQuery::argmax_rect(int tile_x, int tile_y, int rect_width, int rect_height) {
+    std::vector<QueryResult> out;
+    top_k_rect(tile_x, tile_y, rect_width, rect_height, 1, false, out);
+    return out.empty() ? QueryResult{-1, -1, 0.0f} : out[0];
+}
+
+QueryResult InfluenceQuery::argmin_rect(int tile_x, int tile_y, int rect_width, int rect_height) {
+    std::vector<QueryResult> out;
+    top_k_rect(tile_x, tile_y, rect_width, rect_height, 1, true, out);
+    return out.empty() ? QueryResult{-1, -1, 0.0f} : out[0];
+}
+
+QueryResult InfluenceQuery::argmax_radius(int center_x, int center_y, int radius) {
+    std::vector<QueryResult> out;
+    top_k_radius(center_x, center_y, radius, 1, false, out);
+    return out.empty() ? QueryResult{-1, -1, 0.0f} : out[0];
+}
+
+QueryResult InfluenceQuery::argmin_radius(int center_x, int center_y, int radius) {
+    std::vector<QueryResult> out;
+    top_k_radius(center_x, center_y, radius, 1, true, out);
+    return out.empty() ? QueryResult{-1, -1, 0.0f} : out[0];
+}
+
+void InfluenceQuery::top_k_rect(int tile_x, int tile_y, int rect_width, int rect_height, int count, bool lowest, std::vector<QueryResult>& out) {
+    INFLUENCE_PROFILE_SCOPE(map->get_profile_counters(), ProfilePhase::QUERY, "query", map->get_name());
+    INFLUENCE_PROFILE(map->get_profile_counters().add_queries(1));
+    refresh();
+    search(rect_region(tile_x, tile_y, rect_width, rect_height), count, lowest, out);
+}
+
+void InfluenceQuery::top_k_radius(int center_x, int center_y, int radius, int count, bool lowest, std::vector<QueryResult>& out) {
+    INFLUENCE_PROFILE_SCOPE(map->get_profile_counters(), ProfilePhase::QUERY, "query", map->get_name());
+    INFLUENCE_PROFILE(map->get_profile_counters().add_queries(1));
+    refresh();
+    search(disc_region(center_x, center_y, radius), count, lowest, out);
+}
+
+void InfluenceQuery::run_batch(const std::vector<RadiusQuery>& queries, std::vector<std::vector<QueryResult>>& out, ThreadPool* pool) {
+    INFLUENCE_PROFILE_SCOPE(map->get_profile_counters(), ProfilePhase::QUERY, "query", map->get_name());
+    INFLUENCE_PROFILE(map->get_profile_counters().add_queries(queries.size()));
+    refresh();
+    out.resize(queries.size());
+
+    auto run_range = [this, &queries, &out](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            const RadiusQuery& query = queries[i];
+            search(disc_region(query.center_x, query.center_y, query.radius), query.count, query.lowest, out[i]);
+        }
+    };
+
+    if (pool == nullptr || pool->get_concurrency() <= 1 || queries.size() <= static_cast<std::size_t>(BATCH_TASK_SIZE)) {
+        run_range(0, queries.size());
+        return;
+    }
+
+    // search only reads the tables, so queries of one batch can run concurrently
+    std::vector<std::function<void()>> tasks;
+    for (std::size_t first = 0; first < queries.size(); first += BATCH_TASK_SIZE) {
+        std::size_t last = std::min(first + BATCH_TASK_SIZE, queries.size());
+        tasks.push_back([&run_range, first, last]() { run_range(first, last); });
+    }
+    pool->run(tasks);
+}
+
+void InfluenceQuery::search(const Region& region, int count, bool lowest, std::vector<QueryResult>& out) const {
+    out.clear();
+    if (count <= 0 || region.x0 > region.x1 || region.y0 > region.y1) {
+        return;
+    }
+
+    // start from the level whose cells are about as large as the region, at most 3x3 of them cover it
+    int extent = std::max(region.x1 - region.x0, region.y1 - region.y0) + 1;
+    int start = 0;
+    while (start + 1 < static_cast<int>(max_levels.size()) && (1 << (start + 1)) <= extent) {
+        ++start;
+    }
+
+    // best first: a popped tile beats every cell still on the heap because cell bounds cover their tiles
+    std::vector<SearchCell> heap;
+    heap.reserve(64);
+    for (int cell_y = region.y0 >> start; cell_y <= region.y1 >> start; ++cell_y) {
+        for (int cell_x = region.x0 >> start; cell_x <= region.x1 >> start; ++cell_x) {
+            if (intersects(region, start, cell_x, cell_y)) {
+                heap.push_back({cell_bound(start, cell_x, cell_y, lowest), start, cell_x, cell_y});
+            }
+        }
+    }
+    std::make_heap(heap.begin(), heap.end());
+
+    while (!heap.empty() && static_cast<int>(out.size()) < count) {
+        std::pop_heap(heap.begin(), heap.end());
+        SearchCell cell = heap.back();
+        heap.pop_back();
+
+        if (cell.level == 0) {
+            out.push_back({cell.cell_x, cell.cell_y, lowest ? -cell.key : cell.key});
+            continue;
+        }
+
+        int child_level = cell.level - 1;
+        for (int dy = 0; dy < 2; ++dy) {
+            for (int dx = 0; dx < 2; ++dx) {
+                int child_x = cell.cell_x * 2 + dx;
+                int child_y = cell.cell_y * 2 + dy;
+                if (child_x < level_widths[child_level] && child_y < level_heights[child_level] &&
+                        intersects(region, child_level, child_x, child_y)) {
+                    heap.push_back({cell_bound(child_level, child_x, child_y, lowest), child_level, child_x, child_y});
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+    }
+}
+
+bool InfluenceQuery::intersects(const Region& region, int level, int cell_x, int cell_y) const {
+    int x0 = cell_x << level;
+    int y0 = cell_y << level;
+    int x1 = std::min(((cell_x + 1) << level), width) - 1;
+    int y1 = std::min(((cell_y + 1) << level), height) - 1;
+
+    if (x1 < region.x0 || x0 > region.x1 || y1 < region.y0 || y0 > region.y1) {
+        return false;
+    }
+    if (!region.disc) {
+        return true;
+    }
+
+    // closest tile of the cell to the center
+    long long dx = std::clamp(region.center_x, x0, x1) - region.center_x;
+    long long dy = std::clamp(region.center_y, y0, y1) - region.center_y;
+    return dx * dx + dy * dy <= region.radius_squared;
+}
+
+float InfluenceQuery::cell_bound(int level, int cell_x, int cell_y, bool lowest) const {
+    if (level == 0) {
+        float value = map->get_influence_map()[static_cast<std::size_t>(width) * cell_y + cell_x];
+        return lowest ? -value : value;
+    }
+
+    std::size_t index = static_cast<std::size_t>(level_widths[level]) * cell_y + cell_x;
+    return lowest ? -min_levels[level][index] : max_levels[level][index];
+}
+
+InfluenceQuery::Region InfluenceQuery::rect_region(int tile_x, int tile_y, int rect_width, int rect_height) const {
+    Region region;
+    region.x0 = std::max(tile_x, 0);
+    region.y0 = std::max(tile_y, 0);
+    region.x1 = std::min(tile_x + rect_width, width) - 1;
+    region.y1 = std::min(tile_y + rect_height, height) - 1;
+    region.disc = false;
+    region.center_x = region.center_y = 0;
+    region.radius_squared = 0;
+    return region;
+}
+
+InfluenceQuery::Region InfluenceQuery::disc_region(int center_x, int center_y, int radius) const {
+    Region region = rect_region(center_x - radius, center_y - radius, 2 * radius + 1, 2 * radius + 1);
+    region.disc = true;
+    region.center_x = center_x;
+    region.center_y = center_y;
+    region.radius_squared = static_cast<long long>(radius) * radius;
+    return region;
+}
@@ -0,0 +1,33 @@
+#include <algorithm>
+#include <cmath>
+
+#include <lockstep_scheduler.hpp>
+
+LockstepScheduler::LockstepScheduler(double tick_seconds, int max_ticks_per_update) :
+    tick_nanoseconds(std::max<std::int64_t>(std::llround(tick_seconds * 1e9), 1)),
+    max_ticks_per_update(std::max(max_ticks_per_update, 1)),
+    accumulated(0),
+    tick(0) {}
+
+int LockstepScheduler::update(double elapsed_seconds, const std::function<void(std::uint64_t)>& step) {
+    // a clock going backwards adds nothing instead of taking ticks back
+    accumulated += std::max<std::int64_t>(std::llround(elapsed_seconds * 1e9), 0);
+
+    int ran = 0;
+    while (accumulated >= tick_nanoseconds && ran < max_ticks_per_update) {
+        step(tick);
+        ++tick;
+        accumulated -= tick_nanoseconds;
+        ++ran;
+    }
+    return ran;
+}
+
+void LockstepScheduler::reset() {
+    accumulated = 0;
+    tick = 0;
+}
+
+const double LockstepScheduler::get_alpha() const {
+    return std::min(static_cast<double>(accumulated) / tick_nanoseconds, 1.0);
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -12,64 +14,120 @@
 
 #include <collision_map.hpp>
 #include <influence_map.hpp>
+#include <lockstep_scheduler.hpp>
+#include <map_renderer.hpp>
+#include <parallel_update.hpp>
+#include <profiler.hpp>
+#include <thread_pool.hpp>
 
 const int SCREEN_WIDTH = 1600;
 const int SCREEN_HEIGHT = 1080;
 const int FPS = 30;
+// simulation ticks per second, the scheduler keeps this rate whatever the frame rate
+const double TICK_SECONDS = 0.1;
+const int MAX_TICKS_PER_UPDATE = 8;
 
 ALLEGRO_DISPLAY* display;
 ALLEGRO_TIMER* loop_timer;
-ALLEGRO_TIMER* influence_timer;
+// drives the simulation on its own, apart from the frames
+ALLEGRO_TIMER* tick_timer;
 ALLEGRO_EVENT_QUEUE* ev_queue;
 ALLEGRO_FONT* bitmap_font;
 
 enum class MouseEditMode {
     BLOCK_TILE,
-    PLACE_INFLUENCE
+    PLACE_INFLUENCE,
+    PAINT_TERRAIN
 };
 
-void draw_collision_map(std::shared_ptr<CollisionMap> map, int start_x, int start_y, int end_x, int end_y) {
-    int width = map->get_width();
-    int height = map->get_height();
-    int tile_size = map->get_tile_size();
-    const auto& collision_map = map->get_collision_map();
-
-    for (int y = std::max(start_y / tile_size, 0); y < height && y * tile_size < end_y; y++) {
-        for (int x = std::max(start_x / tile_size, 0); x < width && x * tile_size < end_x; x++) {
-            al_draw_rectangle(x * tile_size - start_x, y * tile_size - start_y,
-                    (x + 1) * tile_size - start_x, (y + 1) * tile_size - start_y,
-                    al_map_rgb(225, 225, 225), 1.0f);
-            if (collision_map[width * y + x]) {
-                al_draw_filled_rectangle(x * tile_size + 1 - start_x, y * tile_size + 1 - start_y,
-                        (x + 1) * tile_size - 1 - start_x, (y + 1) * tile_size - 1 - start_y,
-                        al_map_rgb(225, 0, 0));
-            }
+// terrain classes of the demo, new influence maps get DEMO_TERRAIN_COSTS for them
+const char* DEMO_TERRAIN_NAMES = "Open\0" "Forest\0" "Water\0" "Road\0";
+const float DEMO_TERRAIN_COSTS[] = {1.0f, 2.0f, 4.0f, 0.5f};
+
+const char* TRACE_PATH = "influence_trace.json";
+const ImU32 PHASE_COLORS[PROFILE_PHASE_COUNT] = {IM_COL32(230, 160, 60, 255), IM_COL32(80, 160, 230, 255),
+    IM_COL32(120, 200, 120, 255), IM_COL32(200, 110, 200, 255)};
+
+// counters of every map and one bar per map split by where its time went, plus the trace controls
+void draw_profiler_window(const std::vector<std::shared_ptr<InfluenceMap>>& influence_maps) {
+    ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+#ifndef INFLUENCE_PROFILING
+    ImGui::Text("Built without INFLUENCE_MAPS_PROFILING, counters stay at zero");
+#endif
+
+    if (!is_tracing() && ImGui::Button("Start trace")) {
+        start_trace();
+    }
+    else if (is_tracing() && ImGui::Button("Stop trace")) {
+        stop_trace();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace")) {
+        std::cout << (write_chrome_trace(TRACE_PATH) ? "Saved trace to " : "Could not write ") << TRACE_PATH << std::endl;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reset counters")) {
+        for (const auto& map : influence_maps) {
+            map->reset_profile();
         }
     }
-}
 
-void draw_influence_map(std::shared_ptr<InfluenceMap> map, int start_x, int start_y, int end_x, int end_y) {
-    int width = map->get_width();
-    int height = map->get_height();
-    int tile_size = map->get_tile_size();
-    float strength = map->get_strength();
-    const auto& influence_map = map->get_influence_map();
-
-    for (int y = std::max(start_y / tile_size, 0); y < height && y * tile_size < end_y; y++) {
-        for (int x = std::max(start_x / tile_size, 0); x < width && x * tile_size < end_x; x++) {
-            if (influence_map[width * y + x] >= 0.1) {
-                al_draw_filled_rectangle(x * tile_size + 1 - start_x, y * tile_size + 1 - start_y,
-                        (x + 1) * tile_size - 1 - start_x, (y + 1) * tile_size - 1 - start_y,
-                        al_map_rgba(0, 0, 225, influence_map[width * y + x] * 255 / strength));
-                al_draw_textf(bitmap_font, al_map_rgb(230, 230, 230),
-                        x * tile_size - start_x + tile_size / 3.4, y * tile_size - start_y + tile_size / 2.5, 0,
-                        "%.2f", influence_map[width * y + x]);
+    // legend, the bars below use the same colors
+    for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+        ImGui::ColorButton(get_profile_phase_name(static_cast<ProfilePhase>(p)), ImColor(PHASE_COLORS[p]), ImGuiColorEditFlags_NoTooltip, ImVec2(12, 12));
+        ImGui::SameLine();
+        ImGui::Text("%s", get_profile_phase_name(static_cast<ProfilePhase>(p)));
+        ImGui::SameLine();
+    }
+    ImGui::NewLine();
+    ImGui::Separator();
+
+    for (const auto& map : influence_maps) {
+        ProfileStats stats = map->get_profile_stats();
+        double steps = static_cast<double>(std::max<std::uint64_t>(stats.steps, 1));
+        std::uint64_t total = 0;
+        for (std::uint64_t nanoseconds : stats.phase_nanoseconds) {
+            total += nanoseconds;
+        }
+
+        ImGui::Text("%s: %llu steps, %.3f ms per step", map->get_name().c_str(), static_cast<unsigned long long>(stats.steps),
+                (total - stats.phase_nanoseconds[static_cast<int>(ProfilePhase::QUERY)]) * 1e-6 / steps);
+        ImGui::Text("tiles %.0f per step, %.1f%% changed, %.1f sources stamped per step, %llu queries",
+                stats.tiles_processed / steps, stats.tiles_processed > 0 ? 100.0 * stats.tiles_changed / stats.tiles_processed : 0.0,
+                stats.sources_stamped / steps, static_cast<unsigned long long>(stats.queries));
+
+        // share of the total per phase, hovering a bar shows the numbers
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        float bar_width = 400.0f;
+        float x = origin.x;
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+            if (total == 0) {
+                break;
+            }
+
+            float width = bar_width * stats.phase_nanoseconds[p] / total;
+            draw_list->AddRectFilled(ImVec2(x, origin.y), ImVec2(x + width, origin.y + 14.0f), PHASE_COLORS[p]);
+            if (ImGui::IsMouseHoveringRect(ImVec2(x, origin.y), ImVec2(x + width, origin.y + 14.0f))) {
+                ImGui::SetTooltip("%s: %.3f ms in %llu calls", get_profile_phase_name(static_cast<ProfilePhase>(p)),
+                        stats.get_phase_milliseconds(static_cast<ProfilePhase>(p)), static_cast<unsigned long long>(stats.phase_calls[p]));
             }
+            x += width;
         }
+        ImGui::Dummy(ImVec2(bar_width, 16.0f));
+    }
+
+    if (is_tracing() || get_dropped_trace_events() > 0) {
+        ImGui::Separator();
+        ImGui::Text("Trace %s, %llu events dropped", is_tracing() ? "running" : "stopped",
+                static_cast<unsigned long long>(get_dropped_trace_events()));
     }
+
+    ImGui::End();
 }
 
-int main(int argc, char** argv) {
+int main(int, char**) {
     al_init();
     al_init_primitives_addon();
     al_init_image_addon();
@@ -79,7 +137,7 @@ int main(int argc, char** argv) {
 
     display = al_create_display(SCREEN_WIDTH, SCREEN_HEIGHT);
     loop_timer = al_create_timer(1.0f / FPS);
-    influence_timer = al_create_timer(0.1f);
+    tick_timer = al_create_timer(TICK_SECONDS);
 
     // setup blending for non-premultiplied alpha
     al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
@@ -92,7 +150,7 @@ int main(int argc, char** argv) {
     al_register_event_source(ev_queue, al_get_mouse_event_source());
     al_register_event_source(ev_queue, al_get_display_event_source(display));
     al_register_event_source(ev_queue, al_get_timer_event_source(loop_timer));
-    al_register_event_source(ev_queue, al_get_timer_event_source(influence_timer));
+    al_register_event_source(ev_queue, al_get_timer_event_source(tick_timer));
 
     // setup imgui
     IMGUI_CHECKVERSION();
@@ -111,27 +169,35 @@ int main(int argc, char** argv) {
     bool redraw = true;
     ALLEGRO_EVENT ev;
     ALLEGRO_MOUSE_STATE mouse;
-    ALLEGRO_KEYBOARD_STATE keyboard;
 
     // demo variables
-    int cam_x = 0;
-    int cam_y = 0;
+    Camera camera = {0.0f, 0.0f, 1.0f};
     int cam_x_vel = 0;
     int cam_y_vel = 0;
-    bool map_exists = false;
     int tile_size = 64;
     int map_width = 50, map_height = 50;
     MouseEditMode mouse_edit_mode = MouseEditMode::BLOCK_TILE;
+    int terrain_brush = 1;
 
     std::shared_ptr<CollisionMap> collision_map = nullptr;
 
     std::string inf_map_name;
     float inf_map_strength = 5.0f, inf_map_decay = 0.5f, inf_map_momentum = 0.3f;
+    int inf_map_stencil = 0, inf_map_combine_rule = 0;
+    float source_strength = 5.0f;
     std::shared_ptr<InfluenceMap> selected_inf_map = nullptr;
     std::vector<std::shared_ptr<InfluenceMap>> influence_maps;
+    ThreadPool update_pool;
+    MapRenderer renderer(bitmap_font);
+    LockstepScheduler scheduler(TICK_SECONDS, MAX_TICKS_PER_UPDATE);
+
+    // tile under a screen position, the camera may be zoomed
+    auto screen_to_tile_x = [&](int screen_x) { return static_cast<int>(std::floor(camera.to_world_x(screen_x) / tile_size)); };
+    auto screen_to_tile_y = [&](int screen_y) { return static_cast<int>(std::floor(camera.to_world_y(screen_y) / tile_size)); };
 
     al_start_timer(loop_timer);
-    al_start_timer(influence_timer);
+    al_start_timer(tick_timer);
+    double last_update_time = al_get_time();
 
     while (!done) {
         al_wait_for_event(ev_queue, &ev);
@@ -149,11 +215,15 @@ int main(int argc, char** argv) {
             if (ev.timer.source == loop_timer) {
                 redraw = true;
             }
-            else if (ev.timer.source == influence_timer) {
-                for (auto& inf : influence_maps) {
-                    //inf->print_values();
-                    inf->recalculate();
-                }
+            else if (ev.timer.source == tick_timer) {
+                // the simulation has its own timer so the frame rate does not decide when ticks run, it follows
+                // the real time that passed and a stall is made up with several ticks
+                double now = al_get_time();
+                scheduler.update(now - last_update_time, [&](std::uint64_t) {
+                    INFLUENCE_TRACE_SCOPE("tick");
+                    recalculate_parallel(update_pool, influence_maps);
+                });
+                last_update_time = now;
             }
         }
         else if (ev.type == ALLEGRO_EVENT_KEY_DOWN) {
@@ -170,6 +240,14 @@ int main(int argc, char** argv) {
                 case ALLEGRO_KEY_RIGHT:
                     cam_x_vel = 5;
                     break;
+                case ALLEGRO_KEY_EQUALS:
+                case ALLEGRO_KEY_PAD_PLUS:
+                    camera.zoom_at(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, 1.25f);
+                    break;
+                case ALLEGRO_KEY_MINUS:
+                case ALLEGRO_KEY_PAD_MINUS:
+                    camera.zoom_at(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, 0.8f);
+                    break;
             }
         }
         else if (ev.type == ALLEGRO_EVENT_KEY_UP) {
@@ -184,15 +262,20 @@ int main(int argc, char** argv) {
                     break;
             }
         }
+        else if (ev.type == ALLEGRO_EVENT_MOUSE_AXES) {
+            // the wheel zooms around the cursor
+            if (ev.mouse.dz != 0 && !io.WantCaptureMouse) {
+                camera.zoom_at(ev.mouse.x, ev.mouse.y, std::pow(1.25f, static_cast<float>(ev.mouse.dz)));
+            }
+        }
         else if (ev.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP) {
             if (mouse_edit_mode == MouseEditMode::PLACE_INFLUENCE && !io.WantCaptureMouse) {
-                int tile_x = (cam_x + ev.mouse.x) / tile_size;
-                int tile_y = (cam_y + ev.mouse.y) / tile_size;
+                int tile_x = screen_to_tile_x(ev.mouse.x);
+                int tile_y = screen_to_tile_y(ev.mouse.y);
 
                 if (ev.mouse.button == 1) {
                     if (selected_inf_map != nullptr) {
-                        
-                        selected_inf_map->add_influence(tile_x, tile_y);
+                        selected_inf_map->add_influence(tile_x, tile_y, source_strength);
                         std::cout << "Created influence at (" << tile_x << ", " << tile_y << ")" << std::endl;
                     }
                 }
@@ -206,28 +289,33 @@ int main(int argc, char** argv) {
         }
 
         // logic for drawing on map
-        if (mouse_edit_mode == MouseEditMode::BLOCK_TILE && !io.WantCaptureMouse) {
+        if ((mouse_edit_mode == MouseEditMode::BLOCK_TILE || mouse_edit_mode == MouseEditMode::PAINT_TERRAIN) && !io.WantCaptureMouse) {
             if (collision_map != nullptr) {
                 al_get_mouse_state(&mouse);
 
                 if (mouse.buttons & 1) {
                     if (mouse_edit_mode == MouseEditMode::BLOCK_TILE) {
-                        collision_map->set_blocked((cam_x + mouse.x) / tile_size, (cam_y + mouse.y) / tile_size, true);
+                        collision_map->set_blocked(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y), true);
+                    }
+                    else if (mouse_edit_mode == MouseEditMode::PAINT_TERRAIN) {
+                        collision_map->set_terrain(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y), terrain_brush);
                     }
                     else if (mouse_edit_mode == MouseEditMode::PLACE_INFLUENCE) {
                         if (selected_inf_map != nullptr) {
-                            // TODO allow setting of different influence values
-                            selected_inf_map->add_influence((cam_x + mouse.x) / tile_size, (cam_y + mouse.y) / tile_size);
+                            selected_inf_map->add_influence(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y), source_strength);
                         }
                     }
                 }
                 else if (mouse.buttons & 2) {
                     if (mouse_edit_mode == MouseEditMode::BLOCK_TILE) {
-                        collision_map->set_blocked((cam_x + mouse.x) / tile_size, (cam_y + mouse.y) / tile_size, false);
+                        collision_map->set_blocked(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y), false);
+                    }
+                    else if (mouse_edit_mode == MouseEditMode::PAINT_TERRAIN) {
+                        collision_map->set_terrain(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y), 0);
                     }
                     else if (mouse_edit_mode == MouseEditMode::PLACE_INFLUENCE) {
                         if (selected_inf_map != nullptr) {
-                            selected_inf_map->remove_influence((cam_x + mouse.x) / tile_size, (cam_y + mouse.y) / tile_size);
+                            selected_inf_map->remove_influence(screen_to_tile_x(mouse.x), screen_to_tile_y(mouse.y));
                         }
                     }
                 }
@@ -235,11 +323,12 @@ int main(int argc, char** argv) {
         }
 
         if (redraw) {
+            INFLUENCE_TRACE_SCOPE("frame");
             redraw = false;
 
-            // move the camera
-            cam_x += cam_x_vel;
-            cam_y += cam_y_vel;
+            // move the camera, the speed is in screen pixels whatever the zoom
+            camera.x += cam_x_vel / camera.zoom;
+            camera.y += cam_y_vel / camera.zoom;
 
             // UI logic
             ImGui_ImplAllegro5_NewFrame();
@@ -255,6 +344,19 @@ int main(int argc, char** argv) {
             if (ImGui::RadioButton("Add/remove influence", mouse_edit_mode == MouseEditMode::PLACE_INFLUENCE)) {
                 mouse_edit_mode = MouseEditMode::PLACE_INFLUENCE;
             }
+            if (ImGui::RadioButton("Paint/erase terrain", mouse_edit_mode == MouseEditMode::PAINT_TERRAIN)) {
+                mouse_edit_mode = MouseEditMode::PAINT_TERRAIN;
+            }
+            ImGui::SliderFloat("Source strength", &source_strength, -30.0f, 30.0f);
+            ImGui::Combo("Terrain", &terrain_brush, DEMO_TERRAIN_NAMES);
+            ImGui::Separator();
+            ImGui::Text("Zoom %.2fx (mouse wheel or +/-)", camera.zoom);
+            ImGui::Text("Influence rows uploaded: %d", renderer.get_uploaded_rows());
+            ImGui::Text("Tick %llu, %llu behind", static_cast<unsigned long long>(scheduler.get_tick()),
+                    static_cast<unsigned long long>(scheduler.get_pending_ticks()));
+            if (selected_inf_map != nullptr) {
+                ImGui::Text("State hash %016llx", static_cast<unsigned long long>(selected_inf_map->get_state_hash()));
+            }
 
             ImGui::End();
 
@@ -268,6 +370,8 @@ int main(int argc, char** argv) {
                 if (ImGui::Button("Delete Map")) {
                     collision_map.reset();
                     influence_maps.clear();
+                    selected_inf_map.reset();
+                    renderer.reset();
                 }
             }
             else {
@@ -292,15 +396,22 @@ int main(int argc, char** argv) {
                 ImGui::SliderFloat("Strength", &inf_map_strength, -30.0f, 30.0f);
                 ImGui::SliderFloat("Decay", &inf_map_decay, 0.0001f, 1.0f);
                 ImGui::SliderFloat("Momentum", &inf_map_momentum, 0.0f, 1.0f);
+                ImGui::Combo("Stencil", &inf_map_stencil, "4 neighbors\0" "8 neighbors\0" "Weighted 3x3\0");
+                ImGui::Combo("Combine", &inf_map_combine_rule, "Max abs\0" "Average\0" "Signed max\0");
                 if (ImGui::Button("Create Influence")) {
                     if (inf_map_name.size() > 0) {
                         influence_maps.emplace_back(std::make_shared<InfluenceMap>(inf_map_name, collision_map, inf_map_strength, inf_map_decay, inf_map_momentum));
+                        influence_maps.back()->set_stencil(static_cast<Stencil>(inf_map_stencil), static_cast<CombineRule>(inf_map_combine_rule));
+                        for (int t = 1; t < 4; ++t) {
+                            influence_maps.back()->set_terrain_cost(t, DEMO_TERRAIN_COSTS[t]);
+                        }
                     }
                 }
 
                 ImGui::Separator();
                 ImGui::Text("Influence list");
-                if (ImGui::ListBoxHeader("##influences", influence_maps.size(), 10)) {
+                // ten entries high
+                if (ImGui::BeginListBox("##influences", ImVec2(0.0f, 10 * ImGui::GetTextLineHeightWithSpacing()))) {
                     for (const auto& i : influence_maps) {
                         if (ImGui::Selectable(i->get_name().c_str(), i == selected_inf_map)) {
                             selected_inf_map = i;
@@ -308,26 +419,33 @@ int main(int argc, char** argv) {
                             inf_map_strength = i->get_strength();
                             inf_map_decay = i->get_decay();
                             inf_map_momentum = i->get_momentum();
+                            inf_map_stencil = static_cast<int>(i->get_stencil());
+                            inf_map_combine_rule = static_cast<int>(i->get_combine_rule());
+                            source_strength = i->get_strength();
                         }
                     }
-                    ImGui::ListBoxFooter();
+                    ImGui::EndListBox();
+                }
+                if (selected_inf_map != nullptr && ImGui::Button("Apply stencil")) {
+                    selected_inf_map->set_stencil(static_cast<Stencil>(inf_map_stencil), static_cast<CombineRule>(inf_map_combine_rule));
+                }
+                if (selected_inf_map != nullptr && ImGui::Button("Solve steady state")) {
+                    selected_inf_map->solve_steady_state();
                 }
                 ImGui::End();
             }
 
+            draw_profiler_window(influence_maps);
+
             ImGui::Render();
             al_clear_to_color(al_map_rgb(0, 0, 0));
 
-            // render the collision map
+            // render the collision map and the selected influence map, a few draw calls whatever the zoom
             if (collision_map != nullptr) {
-                draw_collision_map(collision_map, cam_x, cam_y, cam_x + SCREEN_WIDTH, cam_y + SCREEN_HEIGHT);
+                renderer.draw_collision_map(collision_map, camera, SCREEN_WIDTH, SCREEN_HEIGHT);
             }
-
-            // render all influence maps
-            for (const auto& i : influence_maps) {
-                if (i == selected_inf_map) {
-                    draw_influence_map(i, cam_x, cam_y, cam_x + SCREEN_WIDTH, cam_y + SCREEN_HEIGHT);
-                }
+            if (selected_inf_map != nullptr) {
+                renderer.draw_influence_map(selected_inf_map, camera, SCREEN_WIDTH, SCREEN_HEIGHT);
             }
 
             // render GUI
@@ -338,11 +456,13 @@ int main(int argc, char** argv) {
         }
     }
 
+    // the textures have to go before the display
+    renderer.reset();
     ImGui_ImplAllegro5_Shutdown();
     ImGui::DestroyContext();
     al_destroy_font(bitmap_font);
     al_destroy_timer(loop_timer);
-    al_destroy_timer(influence_timer);
+    al_destroy_timer(tick_timer);
     al_destroy_event_queue(ev_queue);
     al_destroy_display(display);
 
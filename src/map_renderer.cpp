@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cmath>
+
+#include <map_renderer.hpp>
+
+namespace {
+
+// texels are written as r, g, b, a bytes
+const int TEXTURE_FORMAT = ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE;
+
+ALLEGRO_BITMAP* create_texture(int width, int height) {
+    int flags = al_get_new_bitmap_flags();
+    int format = al_get_new_bitmap_format();
+
+    // no linear filtering, a tile stays a sharp square at any zoom
+    al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+    al_set_new_bitmap_format(TEXTURE_FORMAT);
+    ALLEGRO_BITMAP* texture = al_create_bitmap(width, height);
+
+    al_set_new_bitmap_flags(flags);
+    al_set_new_bitmap_format(format);
+    return texture;
+}
+
+void set_texel(std::uint8_t* texel, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a) {
+    texel[0] = r;
+    texel[1] = g;
+    texel[2] = b;
+    texel[3] = a;
+}
+
+// blocked tiles red, terrain green for forest, blue for water and grey for road, open ground clear
+void collision_texel(std::uint8_t* texel, bool blocked, std::uint8_t terrain) {
+    if (blocked) {
+        set_texel(texel, 225, 0, 0, 255);
+        return;
+    }
+
+    switch (terrain == 0 ? 0 : (terrain - 1) % 3 + 1) {
+        case 1:
+            set_texel(texel, 30, 90, 30, 255);
+            break;
+        case 2:
+            set_texel(texel, 30, 50, 110, 255);
+            break;
+        case 3:
+            set_texel(texel, 90, 90, 90, 255);
+            break;
+        default:
+            set_texel(texel, 0, 0, 0, 0);
+            break;
+    }
+}
+
+// blue for positive and orange for negative influence, opaque at the strength of the map
+void influence_texel(std::uint8_t* texel, float value, float inverse_strength) {
+    if (std::abs(value) < MapRenderer::MIN_VISIBLE_INFLUENCE) {
+        set_texel(texel, 0, 0, 0, 0);
+        return;
+    }
+
+    std::uint8_t alpha = static_cast<std::uint8_t>(std::min(std::abs(value) * inverse_strength, 1.0f) * 255.0f);
+    if (value > 0.0f) {
+        set_texel(texel, 0, 0, 225, alpha);
+    }
+    else {
+        set_texel(texel, 225, 120, 0, alpha);
+    }
+}
+
+}
+
+void Camera::zoom_at(float screen_x, float screen_y, float factor) {
+    float world_x = to_world_x(screen_x);
+    float world_y = to_world_y(screen_y);
+    zoom = std::clamp(zoom * factor, MIN_ZOOM, MAX_ZOOM);
+    x = world_x - screen_x / zoom;
+    y = world_y - screen_y / zoom;
+}
+
+MapRenderer::MapRenderer(ALLEGRO_FONT* font) :
+    font(font),
+    collision_texture(nullptr),
+    collision_revision(0),
+    influence_texture(nullptr),
+    influence_generation(0),
+    uploaded_rows(0) {}
+
+MapRenderer::~MapRenderer() {
+    reset();
+}
+
+void MapRenderer::reset() {
+    if (collision_texture != nullptr) {
+        al_destroy_bitmap(collision_texture);
+        collision_texture = nullptr;
+    }
+    if (influence_texture != nullptr) {
+        al_destroy_bitmap(influence_texture);
+        influence_texture = nullptr;
+    }
+    collision_source.reset();
+    influence_source.reset();
+    uploaded_rows = 0;
+}
+
+void MapRenderer::draw_collision_map(std::shared_ptr<CollisionMap> map, const Camera& camera, int screen_width, int screen_height) {
+    int tile_size = map->get_tile_size();
+    VisibleTiles visible = visible_tiles(map->get_width(), map->get_height(), tile_size, camera, screen_width, screen_height);
+
+    // a different map starts over with a new texture
+    bool full = collision_texture == nullptr || collision_source.lock() != map;
+    if (full) {
+        if (collision_texture != nullptr) {
+            al_destroy_bitmap(collision_texture);
+        }
+        collision_texture = create_texture(map->get_width(), map->get_height());
+        collision_source = map;
+    }
+    if (full || map->get_revision() != collision_revision) {
+        upload_collision(*map, full);
+    }
+
+    draw_layer(collision_texture, tile_size, camera);
+    if (tile_size * camera.zoom >= GRID_MIN_TILE_PIXELS) {
+        draw_grid(visible, tile_size, camera);
+    }
+}
+
+void MapRenderer::draw_influence_map(std::shared_ptr<InfluenceMap> map, const Camera& camera, int screen_width, int screen_height) {
+    int width = map->get_width();
+    int tile_size = map->get_tile_size();
+    VisibleTiles visible = visible_tiles(width, map->get_height(), tile_size, camera, screen_width, screen_height);
+
+    bool full = influence_texture == nullptr || influence_source.lock() != map;
+    if (full) {
+        if (influence_texture != nullptr) {
+            al_destroy_bitmap(influence_texture);
+        }
+        influence_texture = create_texture(width, map->get_height());
+        influence_source = map;
+    }
+
+    // the map only changes on recalculate() and edits, most frames draw the texture as it is
+    uploaded_rows = 0;
+    if (full || map->get_generation() != influence_generation) {
+        upload_influence(*map, full);
+    }
+
+    draw_layer(influence_texture, tile_size, camera);
+
+    float tile_pixels = tile_size * camera.zoom;
+    if (tile_pixels < LABEL_MIN_TILE_PIXELS) {
+        return;
+    }
+
+    // the builtin font is one bitmap, held drawing turns all labels into one batch
+    const auto& values = map->get_influence_map();
+    al_hold_bitmap_drawing(true);
+    for (int y = visible.y0; y < visible.y1; ++y) {
+        for (int x = visible.x0; x < visible.x1; ++x) {
+            float value = values[static_cast<std::size_t>(width) * y + x];
+            if (std::abs(value) >= MIN_VISIBLE_INFLUENCE) {
+                al_draw_textf(font, al_map_rgb(230, 230, 230),
+                        camera.to_screen_x(x * tile_size) + tile_pixels / 3.4f, camera.to_screen_y(y * tile_size) + tile_pixels / 2.5f, 0,
+                        "%.2f", value);
+            }
+        }
+    }
+    al_hold_bitmap_drawing(false);
+}
+
+MapRenderer::VisibleTiles MapRenderer::visible_tiles(int width, int height, int tile_size, const Camera& camera,
+        int screen_width, int screen_height) const {
+    VisibleTiles visible;
+    visible.x0 = std::clamp(static_cast<int>(std::floor(camera.to_world_x(0.0f) / tile_size)), 0, width);
+    visible.y0 = std::clamp(static_cast<int>(std::floor(camera.to_world_y(0.0f) / tile_size)), 0, height);
+    visible.x1 = std::clamp(static_cast<int>(std::ceil(camera.to_world_x(screen_width) / tile_size)), 0, width);
+    visible.y1 = std::clamp(static_cast<int>(std::ceil(camera.to_world_y(screen_height) / tile_size)), 0, height);
+    return visible;
+}
+
+void MapRenderer::draw_layer(ALLEGRO_BITMAP* texture, int tile_size, const Camera& camera) {
+    int width = al_get_bitmap_width(texture);
+    int height = al_get_bitmap_height(texture);
+    al_draw_scaled_bitmap(texture, 0, 0, width, height, camera.to_screen_x(0.0f), camera.to_screen_y(0.0f),
+            width * tile_size * camera.zoom, height * tile_size * camera.zoom, 0);
+}
+
+void MapRenderer::draw_grid(const VisibleTiles& visible, int tile_size, const Camera& camera) {
+    if (visible.x0 >= visible.x1 || visible.y0 >= visible.y1) {
+        return;
+    }
+
+    ALLEGRO_COLOR color = al_map_rgb(225, 225, 225);
+    auto add_line = [&](float x0, float y0, float x1, float y1) {
+        // half pixel offsets put one pixel wide lines on pixel centers
+        grid_vertices.push_back({x0 + 0.5f, y0 + 0.5f, 0.0f, 0.0f, 0.0f, color});
+        grid_vertices.push_back({x1 + 0.5f, y1 + 0.5f, 0.0f, 0.0f, 0.0f, color});
+    };
+
+    float left = camera.to_screen_x(visible.x0 * tile_size);
+    float right = camera.to_screen_x(visible.x1 * tile_size);
+    float top = camera.to_screen_y(visible.y0 * tile_size);
+    float bottom = camera.to_screen_y(visible.y1 * tile_size);
+
+    grid_vertices.clear();
+    for (int x = visible.x0; x <= visible.x1; ++x) {
+        float screen_x = camera.to_screen_x(x * tile_size);
+        add_line(screen_x, top, screen_x, bottom);
+    }
+    for (int y = visible.y0; y <= visible.y1; ++y) {
+        float screen_y = camera.to_screen_y(y * tile_size);
+        add_line(left, screen_y, right, screen_y);
+    }
+
+    al_draw_prim(grid_vertices.data(), nullptr, nullptr, 0, static_cast<int>(grid_vertices.size()), ALLEGRO_PRIM_LINE_LIST);
+}
+
+void MapRenderer::upload_collision(CollisionMap& map, bool full) {
+    int width = map.get_width();
+    int height = map.get_height();
+
+    // bounding box of the blocks changed since the last upload, one lock covers all of them
+    int x0 = 0, y0 = 0, x1 = width, y1 = height;
+    if (!full) {
+        x0 = width;
+        y0 = height;
+        x1 = 0;
+        y1 = 0;
+        for (int by = 0; by < map.get_blocks_y(); ++by) {
+            for (int bx = 0; bx < map.get_blocks_x(); ++bx) {
+                if (map.get_block_revision(bx, by) > collision_revision) {
+                    x0 = std::min(x0, bx * CollisionMap::BLOCK_SIZE);
+                    y0 = std::min(y0, by * CollisionMap::BLOCK_SIZE);
+                    x1 = std::max(x1, std::min((bx + 1) * CollisionMap::BLOCK_SIZE, width));
+                    y1 = std::max(y1, std::min((by + 1) * CollisionMap::BLOCK_SIZE, height));
+                }
+            }
+        }
+    }
+    collision_revision = map.get_revision();
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    ALLEGRO_LOCKED_REGION* region = al_lock_bitmap_region(collision_texture, x0, y0, x1 - x0, y1 - y0, TEXTURE_FORMAT, ALLEGRO_LOCK_WRITEONLY);
+    if (region == nullptr) {
+        return;
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        std::uint8_t* texels = static_cast<std::uint8_t*>(region->data) + static_cast<std::ptrdiff_t>(region->pitch) * (y - y0);
+        const std::uint64_t* words = map.get_row_words(y);
+        const std::uint8_t* terrain = map.get_terrain_row(y);
+        for (int x = x0; x < x1; ++x) {
+            bool blocked = ((words[x >> 6] >> (x & 63)) & 1) != 0;
+            collision_texel(texels + 4 * (x - x0), blocked, terrain != nullptr ? terrain[x] : 0);
+        }
+    }
+    al_unlock_bitmap(collision_texture);
+}
+
+void MapRenderer::upload_influence(InfluenceMap& map, bool full) {
+    int width = map.get_width();
+    int height = map.get_height();
+    const auto& values = map.get_influence_map();
+    float inverse_strength = 1.0f / std::max(std::abs(map.get_strength()), 1e-6f);
+    std::uint64_t uploaded_generation = influence_generation;
+    influence_generation = map.get_generation();
+
+    // blocks whose generation is past the last upload changed since, each block row locks only the span from its
+    // first to its last changed block so a source moving in one corner does not lock the whole texture
+    for (int by = 0; by < map.get_blocks_y(); ++by) {
+        int first = map.get_blocks_x(), last = 0;
+        for (int bx = 0; bx < map.get_blocks_x(); ++bx) {
+            if (full || map.get_block_generation(bx, by) > uploaded_generation) {
+                first = std::min(first, bx);
+                last = bx + 1;
+            }
+        }
+        if (first >= last) {
+            continue;
+        }
+
+        int x0 = first * CollisionMap::BLOCK_SIZE;
+        int x1 = std::min(last * CollisionMap::BLOCK_SIZE, width);
+        int y0 = by * CollisionMap::BLOCK_SIZE;
+        int y1 = std::min(y0 + CollisionMap::BLOCK_SIZE, height);
+        ALLEGRO_LOCKED_REGION* region = al_lock_bitmap_region(influence_texture, x0, y0, x1 - x0, y1 - y0, TEXTURE_FORMAT, ALLEGRO_LOCK_WRITEONLY);
+        if (region == nullptr) {
+            continue;
+        }
+
+        for (int y = y0; y < y1; ++y) {
+            std::uint8_t* texels = static_cast<std::uint8_t*>(region->data) + static_cast<std::ptrdiff_t>(region->pitch) * (y - y0);
+            const float* row = &values[static_cast<std::size_t>(width) * y];
+            for (int x = x0; x < x1; ++x) {
+                influence_texel(texels + 4 * (x - x0), row[x], inverse_strength);
+            }
+        }
+        al_unlock_bitmap(influence_texture);
+        uploaded_rows += y1 - y0;
+    }
+}
@@ -0,0 +1,31 @@
+#include <algorithm>
+
+#include <parallel_update.hpp>
+
+void recalculate_parallel(ThreadPool& pool, const std::vector<std::shared_ptr<InfluenceMap>>& maps, int tiles_per_task) {
+    std::vector<std::function<void()>> tasks;
+
+    // sources have to be stamped before any band of the same map reads the buffer
+    for (const auto& inf : maps) {
+        inf->begin_recalculate();
+
+        int width = inf->get_width();
+        int height = inf->get_height();
+        int band_rows = std::max(1, tiles_per_task / std::max(width, 1));
+
+        // bands start on block boundaries so incremental maps never share a block between tasks
+        band_rows = (band_rows + CollisionMap::BLOCK_SIZE - 1) / CollisionMap::BLOCK_SIZE * CollisionMap::BLOCK_SIZE;
+
+        for (int y = 0; y < height; y += band_rows) {
+            InfluenceMap* map = inf.get();
+            int last_row = std::min(y + band_rows, height);
+            tasks.emplace_back([map, y, last_row]() { map->recalculate_rows(y, last_row); });
+        }
+    }
+
+    pool.run(tasks);
+
+    for (const auto& inf : maps) {
+        inf->end_recalculate();
+    }
+}
@@ -0,0 +1,207 @@
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+#include <profiler.hpp>
+
+namespace {
+
+struct TraceState {
+    std::mutex mutex;
+    std::atomic<bool> running{false};
+    std::chrono::steady_clock::time_point origin;
+    std::size_t max_events = 0;
+    std::size_t dropped = 0;
+    std::vector<TraceEvent> events;
+};
+
+TraceState& trace_state() {
+    static TraceState state;
+    return state;
+}
+
+std::uint64_t now_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// small stable thread numbers read better in the trace viewers than hashed thread ids
+int current_thread_number() {
+    static std::atomic<int> next_thread{0};
+    thread_local int number = next_thread.fetch_add(1);
+    return number;
+}
+
+void record_event(const char* name, const std::string* detail, std::uint64_t start, std::uint64_t end) {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (state.events.size() >= state.max_events) {
+        ++state.dropped;
+        return;
+    }
+
+    // scopes that began before the trace started are cut at its start
+    std::uint64_t origin = std::chrono::duration_cast<std::chrono::nanoseconds>(state.origin.time_since_epoch()).count();
+    if (end <= origin) {
+        return;
+    }
+    std::uint64_t relative = start > origin ? start - origin : 0;
+    std::uint64_t duration = start > origin ? end - start : end - origin;
+    state.events.push_back({name, detail != nullptr ? *detail : std::string(), relative, duration, current_thread_number()});
+}
+
+void write_json_string(std::FILE* file, const std::string& text) {
+    std::fputc('"', file);
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', file);
+            std::fputc(c, file);
+        }
+        else if (c < 0x20) {
+            std::fprintf(file, "\\u%04x", c);
+        }
+        else {
+            std::fputc(c, file);
+        }
+    }
+    std::fputc('"', file);
+}
+
+}
+
+const char* get_profile_phase_name(ProfilePhase phase) {
+    switch (phase) {
+        case ProfilePhase::STAMP:
+            return "stamp";
+        case ProfilePhase::PROPAGATE:
+            return "propagate";
+        case ProfilePhase::SWAP:
+            return "swap";
+        case ProfilePhase::QUERY:
+            return "query";
+    }
+    return "unknown";
+}
+
+ProfileCounters::ProfileCounters() {
+    reset();
+}
+
+void ProfileCounters::add_tiles(std::uint64_t processed, std::uint64_t changed) {
+    tiles_processed.fetch_add(processed, std::memory_order_relaxed);
+    tiles_changed.fetch_add(changed, std::memory_order_relaxed);
+}
+
+void ProfileCounters::add_phase_time(ProfilePhase phase, std::uint64_t nanoseconds) {
+    phase_nanoseconds[static_cast<int>(phase)].fetch_add(nanoseconds, std::memory_order_relaxed);
+    phase_calls[static_cast<int>(phase)].fetch_add(1, std::memory_order_relaxed);
+}
+
+ProfileStats ProfileCounters::get_stats() const {
+    ProfileStats stats;
+    stats.steps = steps.load(std::memory_order_relaxed);
+    stats.tiles_processed = tiles_processed.load(std::memory_order_relaxed);
+    stats.tiles_changed = tiles_changed.load(std::memory_order_relaxed);
+    stats.sources_stamped = sources_stamped.load(std::memory_order_relaxed);
+    stats.queries = queries.load(std::memory_order_relaxed);
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        stats.phase_nanoseconds[i] = phase_nanoseconds[i].load(std::memory_order_relaxed);
+        stats.phase_calls[i] = phase_calls[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void ProfileCounters::reset() {
+    steps = 0;
+    tiles_processed = 0;
+    tiles_changed = 0;
+    sources_stamped = 0;
+    queries = 0;
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        phase_nanoseconds[i] = 0;
+        phase_calls[i] = 0;
+    }
+}
+
+void start_trace(std::size_t max_events) {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.origin = std::chrono::steady_clock::now();
+    state.max_events = max_events;
+    state.dropped = 0;
+    state.events.clear();
+    state.running = true;
+}
+
+void stop_trace() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.running = false;
+}
+
+bool is_tracing() {
+    return trace_state().running.load(std::memory_order_relaxed);
+}
+
+std::vector<TraceEvent> get_trace_events() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.events;
+}
+
+std::size_t get_dropped_trace_events() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.dropped;
+}
+
+bool write_chrome_trace(const std::string& path) {
+    std::vector<TraceEvent> events = get_trace_events();
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    // complete events ("ph": "X") with microsecond times, the map goes into the args so events of
+    // different maps share a name and stack up in the viewer's summaries
+    std::fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", file);
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const TraceEvent& event = events[i];
+        std::fputs("{\"name\": ", file);
+        write_json_string(file, event.name);
+        std::fprintf(file, ", \"cat\": \"influence\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                event.thread, event.start * 1e-3, event.duration * 1e-3);
+        if (!event.detail.empty()) {
+            std::fputs(", \"args\": {\"map\": ", file);
+            write_json_string(file, event.detail);
+            std::fputc('}', file);
+        }
+        std::fputs(i + 1 < events.size() ? "},\n" : "}\n", file);
+    }
+    std::fputs("]}\n", file);
+
+    return std::fclose(file) == 0;
+}
+
+ProfileScope::ProfileScope(ProfileCounters* counters, ProfilePhase phase, const char* name, const std::string* detail) :
+    counters(counters),
+    phase(phase),
+    name(name),
+    detail(detail),
+    start(now_nanoseconds()) {}
+
+ProfileScope::ProfileScope(const char* name) :
+    ProfileScope(nullptr, ProfilePhase::QUERY, name) {}
+
+ProfileScope::~ProfileScope() {
+    std::uint64_t end = now_nanoseconds();
+    if (counters != nullptr) {
+        counters->add_phase_time(phase, end - start);
+    }
+    if (is_tracing()) {
+        record_event(name, detail, start, end);
+    }
+}
@@ -0,0 +1,210 @@
+#include <cstdlib>
+#include <cstring>
+
+#if defined(INFLUENCE_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <propagation_kernel.hpp>
+#include "propagation_kernel_impl.hpp"
+
+#ifdef INFLUENCE_SIMD_X86
+void propagate_row_sse2(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum);
+void propagate_row_avx2(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum);
+void propagate_fixed_row_sse2(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum);
+void propagate_fixed_row_avx2(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum);
+void propagate_layers_row_sse2(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums);
+void propagate_layers_row_avx2(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums);
+PropagateStencilRowFn get_propagate_stencil_row_sse2(Stencil stencil, CombineRule rule, bool terrain);
+PropagateStencilRowFn get_propagate_stencil_row_avx2(Stencil stencil, CombineRule rule, bool terrain);
+#endif
+
+namespace {
+
+void propagate_row_scalar(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<ScalarVec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_fixed_row_scalar(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<ScalarVec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_layers_row_scalar(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums) {
+    propagate_layers_row_impl<ScalarVec>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+}
+
+SimdLevel parse_simd_override(SimdLevel detected) {
+    const char* value = std::getenv("INFLUENCE_SIMD");
+    if (value == nullptr) {
+        return detected;
+    }
+
+    SimdLevel requested = detected;
+    if (std::strcmp(value, "scalar") == 0) {
+        requested = SimdLevel::SCALAR;
+    }
+    else if (std::strcmp(value, "sse2") == 0) {
+        requested = SimdLevel::SSE2;
+    }
+    else if (std::strcmp(value, "avx2") == 0) {
+        requested = SimdLevel::AVX2;
+    }
+
+    return requested < detected ? requested : detected;
+}
+
+SimdLevel detected_simd_level() {
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+SimdLevel& active_simd_level() {
+    static SimdLevel level = parse_simd_override(detected_simd_level());
+    return level;
+}
+
+}
+
+SimdLevel detect_simd_level() {
+#if defined(INFLUENCE_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool has_sse2 = (info[3] & (1 << 26)) != 0;
+    bool has_avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0;
+    bool os_saves_ymm = has_avx && (_xgetbv(0) & 0x6) == 0x6;
+
+    bool has_avx2 = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        has_avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (has_avx2 && os_saves_ymm) {
+        return SimdLevel::AVX2;
+    }
+    return has_sse2 ? SimdLevel::SSE2 : SimdLevel::SCALAR;
+#elif defined(INFLUENCE_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    return __builtin_cpu_supports("sse2") ? SimdLevel::SSE2 : SimdLevel::SCALAR;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel get_simd_level() {
+    return active_simd_level();
+}
+
+void set_simd_level(SimdLevel level) {
+    SimdLevel detected = detected_simd_level();
+    active_simd_level() = level < detected ? level : detected;
+}
+
+const char* get_simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2:
+            return "sse2";
+        case SimdLevel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+const int get_simd_width(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2:
+            return 4;
+        case SimdLevel::AVX2:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+PropagateRowFn get_propagate_row(SimdLevel level) {
+#ifdef INFLUENCE_SIMD_X86
+    if (level > detected_simd_level()) {
+        level = detected_simd_level();
+    }
+
+    switch (level) {
+        case SimdLevel::AVX2:
+            return propagate_row_avx2;
+        case SimdLevel::SSE2:
+            return propagate_row_sse2;
+        default:
+            break;
+    }
+#endif
+    return propagate_row_scalar;
+}
+
+PropagateFixedRowFn get_propagate_fixed_row(SimdLevel level) {
+#ifdef INFLUENCE_SIMD_X86
+    if (level > detected_simd_level()) {
+        level = detected_simd_level();
+    }
+
+    switch (level) {
+        case SimdLevel::AVX2:
+            return propagate_fixed_row_avx2;
+        case SimdLevel::SSE2:
+            return propagate_fixed_row_sse2;
+        default:
+            break;
+    }
+#endif
+    return propagate_fixed_row_scalar;
+}
+
+PropagateLayersRowFn get_propagate_layers_row(SimdLevel level) {
+#ifdef INFLUENCE_SIMD_X86
+    if (level > detected_simd_level()) {
+        level = detected_simd_level();
+    }
+
+    switch (level) {
+        case SimdLevel::AVX2:
+            return propagate_layers_row_avx2;
+        case SimdLevel::SSE2:
+            return propagate_layers_row_sse2;
+        default:
+            break;
+    }
+#endif
+    return propagate_layers_row_scalar;
+}
+
+PropagateStencilRowFn get_propagate_stencil_row(SimdLevel level, Stencil stencil, CombineRule rule, bool terrain) {
+#ifdef INFLUENCE_SIMD_X86
+    if (level > detected_simd_level()) {
+        level = detected_simd_level();
+    }
+
+    switch (level) {
+        case SimdLevel::AVX2:
+            return get_propagate_stencil_row_avx2(stencil, rule, terrain);
+        case SimdLevel::SSE2:
+            return get_propagate_stencil_row_sse2(stencil, rule, terrain);
+        default:
+            break;
+    }
+#endif
+    return select_stencil_row<ScalarVec>(stencil, rule, terrain);
+}
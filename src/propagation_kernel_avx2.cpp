@@ -0,0 +1,65 @@
+#include <immintrin.h>
+
+#include <propagation_kernel.hpp>
+#include "propagation_kernel_impl.hpp"
+
+namespace {
+
+struct Avx2Vec {
+    static constexpr int width = 8;
+
+    static __m256 zero() { return _mm256_setzero_ps(); }
+    static __m256 set1(float v) { return _mm256_set1_ps(v); }
+    static __m256 load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, __m256 v) { _mm256_storeu_ps(p, v); }
+    static __m256 load(const std::int16_t* p) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+    }
+    static void store(std::int16_t* p, __m256 v) {
+        __m256 clamped = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-FIXED_MAX)), _mm256_set1_ps(FIXED_MAX));
+        __m256i values = _mm256_cvtps_epi32(clamped);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+    }
+    static __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    static __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+    static __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+    static __m256 neg(__m256 a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+    static __m256 max(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+    static __m256 min(__m256 a, __m256 b) { return _mm256_min_ps(a, b); }
+    static __m256 greater(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static __m256 select(__m256 mask, __m256 a, __m256 b) { return _mm256_blendv_ps(b, a, mask); }
+
+    static __m256 blocked(const std::uint64_t* words, int x) {
+        int byte = static_cast<int>((words[x >> 6] >> (x & 63)) & 0xff);
+        __m256i lane_bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+        __m256i bits = _mm256_and_si256(_mm256_set1_epi32(byte), lane_bits);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, lane_bits));
+    }
+
+    static __m256 lookup(const float* table, const std::uint8_t* classes) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(classes));
+        return _mm256_i32gather_ps(table, _mm256_cvtepu8_epi32(bytes), 4);
+    }
+};
+
+}
+
+void propagate_row_avx2(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<Avx2Vec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_fixed_row_avx2(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<Avx2Vec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_layers_row_avx2(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums) {
+    propagate_layers_row_impl<Avx2Vec>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+}
+
+PropagateStencilRowFn get_propagate_stencil_row_avx2(Stencil stencil, CombineRule rule, bool terrain) {
+    return select_stencil_row<Avx2Vec>(stencil, rule, terrain);
+}
@@ -0,0 +1,365 @@
+#ifndef PROPAGATION_KERNEL_IMPL_HPP
+#define PROPAGATION_KERNEL_IMPL_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <propagation_kernel.hpp>
+
+// shared body of the row kernels, included by one translation unit per instruction set
+//
+// V wraps a register type and provides width, zero, set1, load, store, mul, add, sub, neg,
+// max, min, greater (mask of a > b), select (mask ? a : b), blocked (mask of the collision
+// bits for the width tiles starting at x, where x is a multiple of width) and lookup (table entries
+// of the width 8-bit classes starting at classes).
+// load and store also take int16 fixed-point values: loads widen exactly, stores clamp to
+// +-FIXED_MAX and round to nearest even, the default rounding of the vector conversions.
+// max and min follow the maxps/minps rules (a > b ? a : b) so every path rounds and orders
+// zeros the same way, which keeps the results bit-identical across instruction sets.
+//
+// everything lives in an anonymous namespace so each translation unit keeps its own copy
+// compiled for its own instruction set
+namespace {
+
+inline float propagate_max(float a, float b) { return a > b ? a : b; }
+inline float propagate_min(float a, float b) { return a < b ? a : b; }
+
+// one float wide V, for the scalar kernels and the single tiles of the stencil kernels
+struct ScalarVec {
+    static constexpr int width = 1;
+
+    static float zero() { return 0.0f; }
+    static float set1(float v) { return v; }
+    static float load(const float* p) { return *p; }
+    static void store(float* p, float v) { *p = v; }
+    static float load(const std::int16_t* p) { return *p; }
+    static void store(std::int16_t* p, float v) {
+        float clamped = propagate_min(propagate_max(v, -FIXED_MAX), FIXED_MAX);
+        *p = static_cast<std::int16_t>(std::nearbyint(clamped));
+    }
+    static float mul(float a, float b) { return a * b; }
+    static float add(float a, float b) { return a + b; }
+    static float sub(float a, float b) { return a - b; }
+    static float neg(float a) { return -a; }
+    static float max(float a, float b) { return propagate_max(a, b); }
+    static float min(float a, float b) { return propagate_min(a, b); }
+    static bool greater(float a, float b) { return a > b; }
+    static float select(bool mask, float a, float b) { return mask ? a : b; }
+    static bool blocked(const std::uint64_t* words, int x) { return ((words[x >> 6] >> (x & 63)) & 1) != 0; }
+    static float lookup(const float* table, const std::uint8_t* classes) { return table[*classes]; }
+};
+
+// single tile version used for the border columns and the row tail
+inline float propagate_tile(float up, float down, float left, float right, float self, bool blocked,
+        float coefficient, float momentum) {
+    if (blocked) {
+        return 0.0f;
+    }
+
+    float max_influence = 0.0f;
+    float min_influence = 0.0f;
+    const float neighbors[4] = {up, down, left, right};
+
+    for (float n : neighbors) {
+        float tmp_influence = n * coefficient;
+        max_influence = propagate_max(tmp_influence, max_influence);
+        min_influence = propagate_min(tmp_influence, min_influence);
+    }
+
+    // follow the strongest neighbor, positive or negative
+    float target = -min_influence > max_influence ? min_influence : max_influence;
+    return self + momentum * (target - self);
+}
+
+// T is the stored value type, float or int16 fixed-point; the math always runs on floats
+template <typename V, typename T = float>
+void propagate_row_impl(const T* up, const T* mid, const T* down,
+        const std::uint64_t* blocked, T* out, int first, int last, int width, float coefficient, float momentum) {
+    auto tile = [&](int x) {
+        float left = x > 0 ? ScalarVec::load(mid + x - 1) : 0.0f;
+        float right = x < width - 1 ? ScalarVec::load(mid + x + 1) : 0.0f;
+        bool is_blocked = blocked != nullptr && ((blocked[x >> 6] >> (x & 63)) & 1) != 0;
+        ScalarVec::store(out + x, propagate_tile(ScalarVec::load(up + x), ScalarVec::load(down + x), left, right,
+                ScalarVec::load(mid + x), is_blocked, coefficient, momentum));
+    };
+
+    if (first >= last) {
+        return;
+    }
+
+    // run single tiles past the left border and up to the next multiple of the vector width
+    // so vector loads of the collision bits never straddle a 64-bit word
+    int x = first;
+    for (; x < last && (x == 0 || x % V::width != 0); ++x) {
+        tile(x);
+    }
+
+    // interior tiles always have both horizontal neighbors, so no bounds checks are needed
+    const auto coeff = V::set1(coefficient);
+    const auto mom = V::set1(momentum);
+    const auto zero = V::zero();
+
+    int vector_end = last < width - 1 ? last : width - 1;
+
+    for (; x + V::width <= vector_end; x += V::width) {
+        auto max_influence = zero;
+        auto min_influence = zero;
+
+        auto tmp_influence = V::mul(V::load(up + x), coeff);
+        max_influence = V::max(tmp_influence, max_influence);
+        min_influence = V::min(tmp_influence, min_influence);
+
+        tmp_influence = V::mul(V::load(down + x), coeff);
+        max_influence = V::max(tmp_influence, max_influence);
+        min_influence = V::min(tmp_influence, min_influence);
+
+        tmp_influence = V::mul(V::load(mid + x - 1), coeff);
+        max_influence = V::max(tmp_influence, max_influence);
+        min_influence = V::min(tmp_influence, min_influence);
+
+        tmp_influence = V::mul(V::load(mid + x + 1), coeff);
+        max_influence = V::max(tmp_influence, max_influence);
+        min_influence = V::min(tmp_influence, min_influence);
+
+        auto target = V::select(V::greater(V::neg(min_influence), max_influence), min_influence, max_influence);
+        auto self = V::load(mid + x);
+        auto result = V::add(self, V::mul(mom, V::sub(target, self)));
+
+        if (blocked != nullptr) {
+            result = V::select(V::blocked(blocked, x), zero, result);
+        }
+
+        V::store(out + x, result);
+    }
+
+    for (; x < last; ++x) {
+        tile(x);
+    }
+}
+
+// same propagation for several layers at once, every tile holds stride floats (one lane per layer,
+// stride a multiple of the vector width) and each lane has its own coefficient and momentum
+// the collision bit and the loop overhead are paid once per tile for all layers
+// Stride is the tile stride when known at compile time (0 when it is only known at run time) so
+// the common one and two vector tiles get a fully unrolled lane loop with the parameters in registers
+template <typename V, int Stride>
+void propagate_layers_row_fixed(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int runtime_stride, const float* coefficients, const float* momentums) {
+    const int stride = Stride != 0 ? Stride : runtime_stride;
+    const auto zero = V::zero();
+    const auto one = V::set1(1.0f);
+
+    // left and right are null past the borders, walls are masked instead of branched on
+    // because they are scattered and would mispredict
+    auto tile = [&](int x, const float* left, const float* right) {
+        std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(x) * stride;
+        bool is_blocked = blocked != nullptr && ((blocked[x >> 6] >> (x & 63)) & 1) != 0;
+        const auto blocked_mask = V::greater(is_blocked ? one : zero, zero);
+
+        for (int lane = 0; lane < stride; lane += V::width) {
+            const auto coeff = V::load(coefficients + lane);
+            const auto mom = V::load(momentums + lane);
+            auto max_influence = zero;
+            auto min_influence = zero;
+
+            auto tmp_influence = V::mul(V::load(up + offset + lane), coeff);
+            max_influence = V::max(tmp_influence, max_influence);
+            min_influence = V::min(tmp_influence, min_influence);
+
+            tmp_influence = V::mul(V::load(down + offset + lane), coeff);
+            max_influence = V::max(tmp_influence, max_influence);
+            min_influence = V::min(tmp_influence, min_influence);
+
+            tmp_influence = V::mul(left != nullptr ? V::load(left + lane) : zero, coeff);
+            max_influence = V::max(tmp_influence, max_influence);
+            min_influence = V::min(tmp_influence, min_influence);
+
+            tmp_influence = V::mul(right != nullptr ? V::load(right + lane) : zero, coeff);
+            max_influence = V::max(tmp_influence, max_influence);
+            min_influence = V::min(tmp_influence, min_influence);
+
+            auto target = V::select(V::greater(V::neg(min_influence), max_influence), min_influence, max_influence);
+            auto self = V::load(mid + offset + lane);
+            auto result = V::add(self, V::mul(mom, V::sub(target, self)));
+            V::store(out + offset + lane, V::select(blocked_mask, zero, result));
+        }
+    };
+
+    if (first >= last) {
+        return;
+    }
+
+    int x = first;
+    if (x == 0) {
+        tile(0, nullptr, width > 1 ? mid + stride : nullptr);
+        ++x;
+    }
+
+    int interior_end = last < width - 1 ? last : width - 1;
+    for (; x < interior_end; ++x) {
+        std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(x) * stride;
+        tile(x, mid + offset - stride, mid + offset + stride);
+    }
+
+    for (; x < last; ++x) {
+        std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(x) * stride;
+        tile(x, mid + offset - stride, nullptr);
+    }
+}
+
+template <typename V>
+void propagate_layers_row_impl(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums) {
+    if (stride == V::width) {
+        propagate_layers_row_fixed<V, V::width>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+    }
+    else if (stride == 2 * V::width) {
+        propagate_layers_row_fixed<V, 2 * V::width>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+    }
+    else {
+        propagate_layers_row_fixed<V, 0>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+    }
+}
+
+// target of the stencil kernels for Neighbors decayed neighbors, works on vectors and on ScalarVec alike
+template <typename V, int Neighbors, CombineRule Rule, typename T>
+inline T stencil_target(const T* neighbors, const T* coefficients) {
+    if constexpr (Rule == CombineRule::AVERAGE) {
+        // the coefficients already carry the 1 / total weight of the average
+        T sum = V::mul(neighbors[0], coefficients[0]);
+        for (int i = 1; i < Neighbors; ++i) {
+            sum = V::add(sum, V::mul(neighbors[i], coefficients[i]));
+        }
+        return sum;
+    }
+    else {
+        T max_influence = V::zero();
+        T min_influence = V::zero();
+        for (int i = 0; i < Neighbors; ++i) {
+            T tmp_influence = V::mul(neighbors[i], coefficients[i]);
+            max_influence = V::max(tmp_influence, max_influence);
+            min_influence = V::min(tmp_influence, min_influence);
+        }
+
+        if constexpr (Rule == CombineRule::SIGNED_MAX) {
+            return V::add(max_influence, min_influence);
+        }
+        else {
+            return V::select(V::greater(V::neg(min_influence), max_influence), min_influence, max_influence);
+        }
+    }
+}
+
+// propagate_row_impl with a selectable neighborhood and combine rule, each combination is its own
+// instantiation so nothing is decided per tile
+// coefficients holds STENCIL_NEIGHBORS values in the order up, down, left, right, up left, up right,
+// down left, down right, 4 neighbor stencils only read the first four
+// with Terrain the target is scaled by the entry of terrain_coefficients for the tile's terrain class,
+// every rule is either a maximum or a sum of positive multiples so this is the same as scaling each edge
+template <typename V, int Neighbors, CombineRule Rule, bool Terrain>
+void propagate_stencil_row_impl(const float* up, const float* mid, const float* down, const std::uint64_t* blocked,
+        const std::uint8_t* terrain, const float* terrain_coefficients, float* out, int first, int last, int width,
+        const float* coefficients, float momentum) {
+    auto tile = [&](int x) {
+        if (blocked != nullptr && ((blocked[x >> 6] >> (x & 63)) & 1) != 0) {
+            out[x] = 0.0f;
+            return;
+        }
+
+        bool has_left = x > 0;
+        bool has_right = x < width - 1;
+        float neighbors[Neighbors];
+        neighbors[0] = up[x];
+        neighbors[1] = down[x];
+        neighbors[2] = has_left ? mid[x - 1] : 0.0f;
+        neighbors[3] = has_right ? mid[x + 1] : 0.0f;
+        if constexpr (Neighbors == 8) {
+            neighbors[4] = has_left ? up[x - 1] : 0.0f;
+            neighbors[5] = has_right ? up[x + 1] : 0.0f;
+            neighbors[6] = has_left ? down[x - 1] : 0.0f;
+            neighbors[7] = has_right ? down[x + 1] : 0.0f;
+        }
+
+        float target = stencil_target<ScalarVec, Neighbors, Rule>(neighbors, coefficients);
+        if constexpr (Terrain) {
+            target *= terrain_coefficients[terrain[x]];
+        }
+        out[x] = mid[x] + momentum * (target - mid[x]);
+    };
+
+    if (first >= last) {
+        return;
+    }
+
+    int x = first;
+    for (; x < last && (x == 0 || x % V::width != 0); ++x) {
+        tile(x);
+    }
+
+    using T = decltype(V::zero());
+    T coeff[Neighbors];
+    for (int i = 0; i < Neighbors; ++i) {
+        coeff[i] = V::set1(coefficients[i]);
+    }
+    const auto mom = V::set1(momentum);
+    const auto zero = V::zero();
+
+    int vector_end = last < width - 1 ? last : width - 1;
+
+    for (; x + V::width <= vector_end; x += V::width) {
+        T neighbors[Neighbors];
+        neighbors[0] = V::load(up + x);
+        neighbors[1] = V::load(down + x);
+        neighbors[2] = V::load(mid + x - 1);
+        neighbors[3] = V::load(mid + x + 1);
+        if constexpr (Neighbors == 8) {
+            neighbors[4] = V::load(up + x - 1);
+            neighbors[5] = V::load(up + x + 1);
+            neighbors[6] = V::load(down + x - 1);
+            neighbors[7] = V::load(down + x + 1);
+        }
+
+        auto target = stencil_target<V, Neighbors, Rule>(neighbors, coeff);
+        if constexpr (Terrain) {
+            target = V::mul(target, V::lookup(terrain_coefficients, terrain + x));
+        }
+        auto self = V::load(mid + x);
+        auto result = V::add(self, V::mul(mom, V::sub(target, self)));
+
+        if (blocked != nullptr) {
+            result = V::select(V::blocked(blocked, x), zero, result);
+        }
+
+        V::store(out + x, result);
+    }
+
+    for (; x < last; ++x) {
+        tile(x);
+    }
+}
+
+template <typename V, int Neighbors, bool Terrain>
+PropagateStencilRowFn select_stencil_rule(CombineRule rule) {
+    switch (rule) {
+        case CombineRule::AVERAGE:
+            return propagate_stencil_row_impl<V, Neighbors, CombineRule::AVERAGE, Terrain>;
+        case CombineRule::SIGNED_MAX:
+            return propagate_stencil_row_impl<V, Neighbors, CombineRule::SIGNED_MAX, Terrain>;
+        default:
+            return propagate_stencil_row_impl<V, Neighbors, CombineRule::MAX_ABS, Terrain>;
+    }
+}
+
+// the instantiation for one stencil, combine rule and terrain setting, weighted 3x3 stencils share the 8 neighbor code
+template <typename V>
+PropagateStencilRowFn select_stencil_row(Stencil stencil, CombineRule rule, bool terrain) {
+    if (stencil == Stencil::FOUR) {
+        return terrain ? select_stencil_rule<V, 4, true>(rule) : select_stencil_rule<V, 4, false>(rule);
+    }
+    return terrain ? select_stencil_rule<V, 8, true>(rule) : select_stencil_rule<V, 8, false>(rule);
+}
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include <emmintrin.h>
+
+#include <propagation_kernel.hpp>
+#include "propagation_kernel_impl.hpp"
+
+namespace {
+
+struct Sse2Vec {
+    static constexpr int width = 4;
+
+    static __m128 zero() { return _mm_setzero_ps(); }
+    static __m128 set1(float v) { return _mm_set1_ps(v); }
+    static __m128 load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, __m128 v) { _mm_storeu_ps(p, v); }
+    static __m128 load(const std::int16_t* p) {
+        // sign extend by moving every value into the high half of a 32-bit lane and shifting it back
+        __m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16));
+    }
+    static void store(std::int16_t* p, __m128 v) {
+        __m128 clamped = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-FIXED_MAX)), _mm_set1_ps(FIXED_MAX));
+        __m128i values = _mm_cvtps_epi32(clamped);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(values, values));
+    }
+    static __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    static __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    static __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    static __m128 neg(__m128 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static __m128 max(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+    static __m128 min(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+    static __m128 greater(__m128 a, __m128 b) { return _mm_cmpgt_ps(a, b); }
+    static __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    static __m128 blocked(const std::uint64_t* words, int x) {
+        int nibble = static_cast<int>((words[x >> 6] >> (x & 63)) & 0xf);
+        __m128i lane_bits = _mm_set_epi32(8, 4, 2, 1);
+        __m128i bits = _mm_and_si128(_mm_set1_epi32(nibble), lane_bits);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(bits, lane_bits));
+    }
+
+    static __m128 lookup(const float* table, const std::uint8_t* classes) {
+        return _mm_set_ps(table[classes[3]], table[classes[2]], table[classes[1]], table[classes[0]]);
+    }
+};
+
+}
+
+void propagate_row_sse2(const float* up, const float* mid, const float* down,
+        const std::uint64_t* blocked, float* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<Sse2Vec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_fixed_row_sse2(const std::int16_t* up, const std::int16_t* mid, const std::int16_t* down,
+        const std::uint64_t* blocked, std::int16_t* out, int first, int last, int width, float coefficient, float momentum) {
+    propagate_row_impl<Sse2Vec>(up, mid, down, blocked, out, first, last, width, coefficient, momentum);
+}
+
+void propagate_layers_row_sse2(const float* up, const float* mid, const float* down, const std::uint64_t* blocked, float* out,
+        int first, int last, int width, int stride, const float* coefficients, const float* momentums) {
+    propagate_layers_row_impl<Sse2Vec>(up, mid, down, blocked, out, first, last, width, stride, coefficients, momentums);
+}
+
+PropagateStencilRowFn get_propagate_stencil_row_sse2(Stencil stencil, CombineRule rule, bool terrain) {
+    return select_stencil_row<Sse2Vec>(stencil, rule, terrain);
+}
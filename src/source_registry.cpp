@@ -0,0 +1,67 @@
+#include <source_registry.hpp>
+
+SourceHandle SourceRegistry::add(int x, int y, float strength) {
+    std::uint32_t slot;
+
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else {
+        slot = static_cast<std::uint32_t>(slots.size());
+        // generation 0 is reserved for the null handle
+        slots.push_back({0, 1});
+    }
+
+    slots[slot].dense_index = static_cast<std::uint32_t>(sources.size());
+    sources.push_back({x, y, strength});
+    dense_slots.push_back(slot);
+
+    return {slot, slots[slot].generation};
+}
+
+bool SourceRegistry::remove(SourceHandle handle) {
+    if (get(handle) == nullptr) {
+        return false;
+    }
+
+    // move the last source into the gap to keep the array dense
+    std::uint32_t index = slots[handle.slot].dense_index;
+    std::uint32_t last = static_cast<std::uint32_t>(sources.size() - 1);
+    sources[index] = sources[last];
+    dense_slots[index] = dense_slots[last];
+    slots[dense_slots[index]].dense_index = index;
+    sources.pop_back();
+    dense_slots.pop_back();
+
+    // bumping the generation invalidates every outstanding handle to this slot
+    if (++slots[handle.slot].generation == 0) {
+        slots[handle.slot].generation = 1;
+    }
+    free_slots.push_back(handle.slot);
+
+    return true;
+}
+
+void SourceRegistry::clear() {
+    for (std::uint32_t slot : dense_slots) {
+        if (++slots[slot].generation == 0) {
+            slots[slot].generation = 1;
+        }
+        free_slots.push_back(slot);
+    }
+
+    sources.clear();
+    dense_slots.clear();
+}
+
+InfluenceSource* SourceRegistry::get(SourceHandle handle) {
+    if (handle.slot >= slots.size() || handle.generation == 0 || slots[handle.slot].generation != handle.generation) {
+        return nullptr;
+    }
+    return &sources[slots[handle.slot].dense_index];
+}
+
+const InfluenceSource* SourceRegistry::get(SourceHandle handle) const {
+    return const_cast<SourceRegistry*>(this)->get(handle);
+}
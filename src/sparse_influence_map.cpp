@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <sparse_influence_map.hpp>
+
+namespace {
+
+// chunk plus a one tile halo on every side
+const int SCRATCH_SIZE = SparseInfluenceMap::CHUNK_SIZE + 2;
+
+}
+
+SparseInfluenceMap::SparseInfluenceMap(std::string name, std::shared_ptr<CollisionMap> collision_map, float strength, float decay, float momentum,
+        bool collision_enabled, std::shared_ptr<ChunkPool> pool) :
+    name(name),
+    collision_map(collision_map),
+    strength(strength),
+    decay(decay),
+    momentum(momentum),
+    collision_enabled(collision_enabled),
+    pool(pool != nullptr ? pool : std::make_shared<ChunkPool>(CHUNK_SIZE * CHUNK_SIZE)),
+    width(collision_map->get_width()),
+    height(collision_map->get_height()),
+    chunks_x((width + CHUNK_SIZE - 1) / CHUNK_SIZE),
+    chunks_y((height + CHUNK_SIZE - 1) / CHUNK_SIZE),
+    allocated_chunks(0),
+    zero_threshold(1e-4f),
+    front(chunks_x * chunks_y, nullptr),
+    back(chunks_x * chunks_y, nullptr),
+    has_source(chunks_x * chunks_y, 0),
+    scratch_in(SCRATCH_SIZE * SCRATCH_SIZE, 0.0f),
+    scratch_out(SCRATCH_SIZE * SCRATCH_SIZE, 0.0f) {}
+
+SparseInfluenceMap::~SparseInfluenceMap() {
+    for (float* chunk : front) {
+        pool->release(chunk);
+    }
+    for (float* chunk : back) {
+        pool->release(chunk);
+    }
+}
+
+SourceHandle SparseInfluenceMap::add_source(int tile_x, int tile_y, float source_strength) {
+    if (tile_x < 0 || tile_y < 0 || tile_x >= width || tile_y >= height) {
+        return {};
+    }
+    return sources.add(tile_x, tile_y, source_strength);
+}
+
+bool SparseInfluenceMap::remove_source(SourceHandle handle) {
+    return sources.remove(handle);
+}
+
+bool SparseInfluenceMap::move_source(SourceHandle handle, int tile_x, int tile_y) {
+    InfluenceSource* src = sources.get(handle);
+    if (src == nullptr || tile_x < 0 || tile_y < 0 || tile_x >= width || tile_y >= height) {
+        return false;
+    }
+
+    src->x = tile_x;
+    src->y = tile_y;
+    return true;
+}
+
+float SparseInfluenceMap::get_influence(int tile_x, int tile_y) const {
+    if (tile_x < 0 || tile_y < 0 || tile_x >= width || tile_y >= height) {
+        return 0.0f;
+    }
+
+    const float* chunk = front[chunks_x * (tile_y / CHUNK_SIZE) + tile_x / CHUNK_SIZE];
+    return chunk != nullptr ? chunk[CHUNK_SIZE * (tile_y % CHUNK_SIZE) + tile_x % CHUNK_SIZE] : 0.0f;
+}
+
+void SparseInfluenceMap::recalculate() {
+    // stamp the sources, allocating chunks for them as needed
+    std::fill(has_source.begin(), has_source.end(), 0);
+    for (const auto& src : sources.get_sources()) {
+        int c = chunks_x * (src.y / CHUNK_SIZE) + src.x / CHUNK_SIZE;
+        if (front[c] == nullptr) {
+            front[c] = pool->allocate();
+        }
+        front[c][CHUNK_SIZE * (src.y % CHUNK_SIZE) + src.x % CHUNK_SIZE] = src.strength;
+        has_source[c] = 1;
+    }
+
+    allocated_chunks = 0;
+    for (int cy = 0; cy < chunks_y; ++cy) {
+        for (int cx = 0; cx < chunks_x; ++cx) {
+            int c = chunks_x * cy + cx;
+            if (!needs_update(cx, cy)) {
+                continue;
+            }
+
+            float* out = pool->allocate();
+            if (propagate_chunk(cx, cy, out) || has_source[c]) {
+                back[c] = out;
+                ++allocated_chunks;
+            }
+            else {
+                pool->release(out);
+            }
+        }
+    }
+
+    // every chunk of the new step was written to the back table, the old front can go back to the pool
+    for (float*& chunk : front) {
+        pool->release(chunk);
+        chunk = nullptr;
+    }
+    front.swap(back);
+}
+
+const float* SparseInfluenceMap::read_chunk(int chunk_x, int chunk_y) const {
+    if (chunk_x < 0 || chunk_y < 0 || chunk_x >= chunks_x || chunk_y >= chunks_y) {
+        return pool->get_zero_chunk();
+    }
+
+    const float* chunk = front[chunks_x * chunk_y + chunk_x];
+    return chunk != nullptr ? chunk : pool->get_zero_chunk();
+}
+
+bool SparseInfluenceMap::needs_update(int chunk_x, int chunk_y) const {
+    auto allocated = [&](int cx, int cy) {
+        return cx >= 0 && cy >= 0 && cx < chunks_x && cy < chunks_y && front[chunks_x * cy + cx] != nullptr;
+    };
+
+    // an empty chunk only receives influence through the edges it shares with allocated neighbours
+    return allocated(chunk_x, chunk_y) || allocated(chunk_x - 1, chunk_y) || allocated(chunk_x + 1, chunk_y) ||
+        allocated(chunk_x, chunk_y - 1) || allocated(chunk_x, chunk_y + 1);
+}
+
+bool SparseInfluenceMap::propagate_chunk(int chunk_x, int chunk_y, float* out) {
+    const float* center = read_chunk(chunk_x, chunk_y);
+    const float* above = read_chunk(chunk_x, chunk_y - 1);
+    const float* below = read_chunk(chunk_x, chunk_y + 1);
+    const float* left = read_chunk(chunk_x - 1, chunk_y);
+    const float* right = read_chunk(chunk_x + 1, chunk_y);
+
+    // gather the chunk and its halo into one padded grid so the row kernel sees ordinary rows
+    std::memcpy(&scratch_in[1], &above[CHUNK_SIZE * (CHUNK_SIZE - 1)], CHUNK_SIZE * sizeof(float));
+    std::memcpy(&scratch_in[SCRATCH_SIZE * (SCRATCH_SIZE - 1) + 1], &below[0], CHUNK_SIZE * sizeof(float));
+    for (int y = 0; y < CHUNK_SIZE; ++y) {
+        float* row = &scratch_in[SCRATCH_SIZE * (y + 1)];
+        row[0] = left[CHUNK_SIZE * y + CHUNK_SIZE - 1];
+        std::memcpy(&row[1], &center[CHUNK_SIZE * y], CHUNK_SIZE * sizeof(float));
+        row[SCRATCH_SIZE - 1] = right[CHUNK_SIZE * y];
+    }
+
+    int x0 = chunk_x * CHUNK_SIZE;
+    int y0 = chunk_y * CHUNK_SIZE;
+    int valid_width = std::min(CHUNK_SIZE, width - x0);
+    int valid_height = std::min(CHUNK_SIZE, height - y0);
+    float coefficient = expf(-1.0 * decay);
+    PropagateRowFn propagate_row = get_propagate_row(get_simd_level());
+    bool any_influence = false;
+
+    for (int y = 0; y < valid_height; ++y) {
+        // chunks are 32 aligned so the chunk's collision bits sit inside one word, shifted by one for the halo
+        std::uint64_t blocked_word = 0;
+        if (collision_enabled) {
+            std::uint64_t word = collision_map->get_row_words(y0 + y)[x0 >> 6];
+            blocked_word = ((word >> (x0 & 63)) & 0xffffffffULL) << 1;
+        }
+
+        const float* mid = &scratch_in[SCRATCH_SIZE * (y + 1)];
+        float* result = &scratch_out[SCRATCH_SIZE * (y + 1)];
+        propagate_row(mid - SCRATCH_SIZE, mid, mid + SCRATCH_SIZE, collision_enabled ? &blocked_word : nullptr,
+                result, 1, valid_width + 1, SCRATCH_SIZE, coefficient, momentum);
+
+        float* dest = &out[CHUNK_SIZE * y];
+        for (int x = 0; x < valid_width; ++x) {
+            float value = result[x + 1];
+            if (std::abs(value) < zero_threshold) {
+                value = 0.0f;
+            }
+            dest[x] = value;
+            any_influence = any_influence || value != 0.0f;
+        }
+    }
+
+    return any_influence;
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <collision_map.hpp>
+#include <state_hash.hpp>
+
+namespace {
+
+const std::uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const std::uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const std::uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const std::uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const std::uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+std::uint64_t rotate_left(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+std::uint64_t read64(const unsigned char* bytes) {
+    std::uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint32_t read32(const unsigned char* bytes) {
+    std::uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint64_t xxh_round(std::uint64_t accumulator, std::uint64_t input) {
+    accumulator += input * PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+std::uint64_t xxh_merge_round(std::uint64_t accumulator, std::uint64_t value) {
+    accumulator ^= xxh_round(0, value);
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+}
+
+std::uint64_t xxhash64(const void* data, std::size_t size, std::uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + size;
+    std::uint64_t hash;
+
+    if (size >= 32) {
+        // four independent lanes over 32 byte stripes
+        std::uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        std::uint64_t v2 = seed + PRIME64_2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - PRIME64_1;
+        for (; bytes + 32 <= end; bytes += 32) {
+            v1 = xxh_round(v1, read64(bytes));
+            v2 = xxh_round(v2, read64(bytes + 8));
+            v3 = xxh_round(v3, read64(bytes + 16));
+            v4 = xxh_round(v4, read64(bytes + 24));
+        }
+
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = xxh_merge_round(hash, v1);
+        hash = xxh_merge_round(hash, v2);
+        hash = xxh_merge_round(hash, v3);
+        hash = xxh_merge_round(hash, v4);
+    }
+    else {
+        hash = seed + PRIME64_5;
+    }
+
+    hash += size;
+
+    for (; bytes + 8 <= end; bytes += 8) {
+        hash ^= xxh_round(0, read64(bytes));
+        hash = rotate_left(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (bytes + 4 <= end) {
+        hash ^= static_cast<std::uint64_t>(read32(bytes)) * PRIME64_1;
+        hash = rotate_left(hash, 23) * PRIME64_2 + PRIME64_3;
+        bytes += 4;
+    }
+    for (; bytes < end; ++bytes) {
+        hash ^= *bytes * PRIME64_5;
+        hash = rotate_left(hash, 11) * PRIME64_1;
+    }
+
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::uint64_t hash_grid_block(const float* values, int width, int height, int block_x, int block_y) {
+    // the rows of a block are gathered so the block is hashed in one pass, edge blocks are smaller
+    std::array<float, CollisionMap::BLOCK_SIZE * CollisionMap::BLOCK_SIZE> block;
+    int x0 = block_x * CollisionMap::BLOCK_SIZE;
+    int y0 = block_y * CollisionMap::BLOCK_SIZE;
+    int columns = std::min(CollisionMap::BLOCK_SIZE, width - x0);
+    int rows = std::min(CollisionMap::BLOCK_SIZE, height - y0);
+    for (int y = 0; y < rows; ++y) {
+        std::memcpy(&block[static_cast<std::size_t>(columns) * y], &values[static_cast<std::size_t>(width) * (y0 + y) + x0], columns * sizeof(float));
+    }
+
+    int blocks_x = (width + CollisionMap::BLOCK_SIZE - 1) / CollisionMap::BLOCK_SIZE;
+    return xxhash64(block.data(), static_cast<std::size_t>(columns) * rows * sizeof(float), static_cast<std::uint64_t>(blocks_x) * block_y + block_x);
+}
+
+std::uint64_t hash_grid(const float* values, int width, int height) {
+    std::uint64_t hash = 0;
+    for (int by = 0; by * CollisionMap::BLOCK_SIZE < height; ++by) {
+        for (int bx = 0; bx * CollisionMap::BLOCK_SIZE < width; ++bx) {
+            hash ^= hash_grid_block(values, width, height, bx, by);
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+
+#include <thread_pool.hpp>
+
+ThreadPool::ThreadPool(int thread_count) :
+    queued(0),
+    pending(0),
+    stopping(false) {
+    if (thread_count <= 0) {
+        thread_count = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+    }
+    thread_count = std::max(thread_count, 0);
+
+    // the last queue belongs to whichever thread calls run()
+    for (int i = 0; i <= thread_count; ++i) {
+        queues.emplace_back(std::make_unique<TaskQueue>());
+    }
+    for (int i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run(std::vector<std::function<void()>>& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    int queue_count = static_cast<int>(queues.size());
+    pending = static_cast<int>(tasks.size());
+
+    // deal the tasks out in contiguous runs, neighbouring tasks usually touch neighbouring memory
+    int per_queue = (static_cast<int>(tasks.size()) + queue_count - 1) / queue_count;
+    for (int i = 0; i < static_cast<int>(tasks.size()); ++i) {
+        TaskQueue& queue = *queues[i / per_queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(tasks[i]));
+        ++queued;
+    }
+
+    {
+        // notifying under the lock keeps a worker from missing the wakeup between its check and its wait
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        work_available.notify_all();
+    }
+
+    int caller = queue_count - 1;
+    std::function<void()> task;
+    while (pending > 0) {
+        if (find_task(caller, task)) {
+            task();
+            finish_task();
+        }
+        else {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            batch_done.wait(lock, [&]() { return pending == 0; });
+        }
+    }
+
+    tasks.clear();
+}
+
+bool ThreadPool::find_task(int index, std::function<void()>& task) {
+    int queue_count = static_cast<int>(queues.size());
+
+    // own queue first, newest task is the most likely to still be in cache
+    {
+        TaskQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    // then steal the oldest task from someone else
+    for (int i = 1; i < queue_count; ++i) {
+        TaskQueue& victim = *queues[(index + i) % queue_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::finish_task() {
+    if (--pending == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        batch_done.notify_all();
+    }
+}
+
+void ThreadPool::worker_loop(int index) {
+    std::function<void()> task;
+
+    while (true) {
+        if (find_task(index, task)) {
+            task();
+            finish_task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        work_available.wait(lock, [&]() { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}